@@ -1,17 +1,22 @@
 /* Implementation of simple command-line interface */
 
 #include <ctype.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/select.h>
 #include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "console.h"
+#include "evlog.h"
 #include "report.h"
 #include "web.h"
 
@@ -20,6 +25,23 @@ int simulation = 0;
 int show_entropy = 0;
 static cmd_element_t *cmd_list = NULL;
 static param_element_t *param_list = NULL;
+
+/* Open-addressing tables finding commands and parameters by name.  The lists
+ * above keep them in alphabetical order for help.
+ */
+typedef struct {
+    uint32_t hash;
+    const char *name;
+    void *ele;
+} name_slot_t;
+
+typedef struct {
+    name_slot_t *slots;
+    size_t size; /* Power of 2, or 0 before any name is added */
+    size_t count;
+} name_table_t;
+
+static name_table_t cmd_table, param_table;
 static bool block_flag = false;
 static bool prompt_flag = true;
 
@@ -35,14 +57,50 @@ static double first_time, last_time;
 
 #define RIO_BUFSIZE 8192
 
+/* Regular files are mapped instead, and lines are found with memchr and
+ * terminated in place, in the private copy of their page.
+ */
 typedef struct __rio {
     int fd;                /* File descriptor */
     int count;             /* Unread bytes in internal buffer */
     char *bufptr;          /* Next unread byte in internal buffer */
+    char *map;             /* Mapped file, or NULL */
+    size_t map_len;        /* Length of mapped file */
+    size_t map_pos;        /* Offset of next unread line */
+    struct __prog *prog;   /* Compiled script being run, or NULL */
     char buf[RIO_BUFSIZE]; /* Internal buffer */
     struct __rio *prev;    /* Next element in stack */
 } rio_t;
 
+/* Compiled scripts, written by the compile command, start with PROG_MAGIC
+ * and a prog_header_t in native byte order.  The strings follow, each
+ * NUL-terminated, padded to a multiple of 4 bytes, then the code in 32-bit
+ * words.  Each line of the script becomes the index of its text, for echo,
+ * its argument count and the index of each argument.  Equal strings are
+ * stored once.  Running one replays its lines as source would, minus the
+ * parsing and the command lookup.
+ */
+#define PROG_MAGIC "LAB0CMD\1"
+#define PROG_MAGIC_LEN 8
+
+typedef struct {
+    uint32_t n_strs;   /* Number of strings */
+    uint32_t strs_len; /* Bytes taken by the strings, with padding */
+    uint32_t n_code;   /* Words of code */
+} prog_header_t;
+
+typedef struct __prog {
+    uint32_t n_strs;
+    char **strs;              /* Strings, in the mapped file */
+    uint32_t *lens;           /* Length of each string */
+    cmd_element_t **cmds;     /* Command named by each string, or NULL */
+    const uint32_t *pc, *end; /* Next line to run, end of code */
+    uint32_t max_argc;
+    char **argv; /* Room for the arguments of any line */
+    size_t args_size;
+    char *args; /* Copies of the arguments, which commands may modify */
+} prog_t;
+
 static rio_t *buf_stack;
 static char linebuf[RIO_BUFSIZE];
 
@@ -72,6 +130,95 @@ static void pop_file();
 
 static bool interpret_cmda(int argc, char *argv[]);
 
+static cmd_hook_t cmd_hook = NULL;
+
+void set_cmd_hook(cmd_hook_t hook)
+{
+    cmd_hook = hook;
+}
+
+static idle_hook_t idle_hook = NULL;
+
+void set_idle_hook(idle_hook_t hook)
+{
+    idle_hook = hook;
+}
+
+/* Write out what the user should see, and anything else that should not
+ * wait on them, before blocking for input
+ */
+static void before_input()
+{
+    report_flush();
+    if (idle_hook)
+        idle_hook();
+}
+
+/* FNV-1a hash of a name */
+static uint32_t name_hash(const char *name)
+{
+    uint32_t h = 0x811c9dc5;
+    for (const unsigned char *p = (const unsigned char *) name; *p; p++) {
+        h ^= *p;
+        h *= 0x01000193;
+    }
+    return h;
+}
+
+/* Return the slot holding name, or the empty slot where it belongs */
+static name_slot_t *name_slot(const name_table_t *t,
+                              const char *name,
+                              uint32_t h)
+{
+    size_t mask = t->size - 1;
+    for (size_t i = h & mask;; i = (i + 1) & mask) {
+        name_slot_t *slot = &t->slots[i];
+        if (!slot->name || (slot->hash == h && !strcmp(slot->name, name)))
+            return slot;
+    }
+}
+
+static void *name_find(const name_table_t *t, const char *name)
+{
+    if (!t->size)
+        return NULL;
+    return name_slot(t, name, name_hash(name))->ele;
+}
+
+/* Map name to ele, replacing any earlier element of that name */
+static void name_add(name_table_t *t, const char *name, void *ele)
+{
+    /* Keep the table at most half full */
+    if (2 * (t->count + 1) > t->size) {
+        name_table_t old = *t;
+        t->size = old.size ? 2 * old.size : 64;
+        t->slots = calloc_or_fail(t->size, sizeof(name_slot_t), "name_add");
+        for (size_t i = 0; i < old.size; i++) {
+            if (old.slots[i].name)
+                *name_slot(t, old.slots[i].name, old.slots[i].hash) =
+                    old.slots[i];
+        }
+        if (old.slots)
+            free_array(old.slots, old.size, sizeof(name_slot_t));
+    }
+
+    uint32_t h = name_hash(name);
+    name_slot_t *slot = name_slot(t, name, h);
+    if (!slot->name)
+        t->count++;
+    slot->hash = h;
+    slot->name = name;
+    slot->ele = ele;
+}
+
+static void name_clear(name_table_t *t)
+{
+    if (t->slots)
+        free_array(t->slots, t->size, sizeof(name_slot_t));
+    t->slots = NULL;
+    t->size = t->count = 0;
+}
+
 /* Add a new command */
 void add_cmd(char *name, cmd_func_t operation, char *summary, char *param)
 {
@@ -87,8 +234,11 @@ void add_cmd(char *name, cmd_func_t operation, char *summary, char *param)
     cmd->operation = operation;
     cmd->summary = summary;
     cmd->param = param;
+    cmd->latency = NULL;
+    memset(&cmd->mem, 0, sizeof(cmd->mem));
     cmd->next = next_cmd;
     *last_loc = cmd;
+    name_add(&cmd_table, name, cmd);
 }
 
 /* Add a new parameter */
@@ -109,22 +259,25 @@ void add_param(char *name, int *valp, char *summary, setter_func_t setter)
     param->setter = setter;
     param->next = next_param;
     *last_loc = param;
+    name_add(&param_table, name, param);
 }
 
-/* Parse a string into a command line */
-static char **parse_args(char *line, int *argcp)
+/* Words of the line being interpreted.  The buffers are kept from line to
+ * line, so that parsing allocates only for a line longer than any before.
+ */
+static char *arg_buf = NULL;
+static size_t arg_buf_size = 0;
+static char **arg_vec = NULL;
+static size_t arg_vec_size = 0;
+
+/* Split line into its words, separated by white space, and copy them to
+ * dst, each NUL-terminated.  dst needs strlen(line) + 1 bytes.  The start of
+ * each word is also stored in words, unless it is NULL.
+ * Return the number of words.
+ */
+static int split_words(const char *line, char *dst, char **words)
 {
-    /* Must first determine how many arguments there are.
-     * Replace all white space with null characters
-     */
-    size_t len = strlen(line);
-
-    /* First copy into buffer with each substring null-terminated */
-    char *buf = malloc_or_fail(len + 1, "parse_args");
-    buf[len] = '\0';
-
-    char *src = line;
-    char *dst = buf;
+    const char *src = line;
     bool skipping = true;
     int c;
     int argc = 0;
@@ -138,24 +291,39 @@ static char **parse_args(char *line, int *argcp)
         } else {
             if (skipping) {
                 /* Hit start of new word */
+                if (words)
+                    words[argc] = dst;
                 argc++;
                 skipping = false;
             }
             *dst++ = c;
         }
     }
+    /* Lines read from mapped files have no trailing newline */
+    *dst = '\0';
+    return argc;
+}
 
-    /* Now assemble into array of strings */
-    char **argv = calloc_or_fail(argc, sizeof(char *), "parse_args");
-    src = buf;
-    for (int i = 0; i < argc; i++) {
-        argv[i] = strsave_or_fail(src, "parse_args");
-        src += strlen(argv[i]) + 1;
+/* Parse a string into a command line.  The words are split into arg_buf
+ * and stay valid until the next line is parsed.
+ */
+static char **parse_args(char *line, int *argcp)
+{
+    size_t len = strlen(line);
+    /* A line of len characters has at most (len + 1) / 2 words */
+    if (len + 1 > arg_buf_size) {
+        if (arg_buf) {
+            free_block(arg_buf, arg_buf_size);
+            free_array(arg_vec, arg_vec_size, sizeof(char *));
+        }
+        arg_buf_size = len + 1 > 2 * arg_buf_size ? len + 1 : 2 * arg_buf_size;
+        arg_vec_size = (arg_buf_size + 1) / 2;
+        arg_buf = malloc_or_fail(arg_buf_size, "parse_args");
+        arg_vec = calloc_or_fail(arg_vec_size, sizeof(char *), "parse_args");
     }
 
-    free_block(buf, len + 1);
-    *argcp = argc;
-    return argv;
+    *argcp = split_words(line, arg_buf, arg_vec);
+    return arg_vec;
 }
 
 static void record_error()
@@ -167,18 +335,70 @@ static void record_error()
     }
 }
 
-/* Execute a command that has already been split into arguments */
-static bool interpret_cmda(int argc, char *argv[])
+/* Add the time taken by one run of cmd */
+static void record_latency(cmd_element_t *cmd,
+                           const struct timespec *start,
+                           const struct timespec *end)
+{
+    if (!cmd->latency && !(cmd->latency = hist_new()))
+        return;
+    int64_t ns = (int64_t) (end->tv_sec - start->tv_sec) * 1000000000 +
+                 (end->tv_nsec - start->tv_nsec);
+    hist_record(cmd->latency, ns > 0 ? ns : 0);
+}
+
+/* Add the memory allocated by one run of cmd, whose use rose by peak bytes */
+static void record_mem(cmd_element_t *cmd,
+                       const mem_counts_t *before,
+                       const mem_counts_t *after,
+                       size_t peak)
+{
+    cmd_mem_t *m = &cmd->mem;
+    m->runs++;
+    m->allocs += after->allocs - before->allocs;
+    m->frees += after->frees - before->frees;
+    m->alloc_bytes += after->alloc_bytes - before->alloc_bytes;
+    m->free_bytes += after->free_bytes - before->free_bytes;
+    if (peak > m->peak)
+        m->peak = peak;
+}
+
+/* Run next_cmd, found for argv[0], or report it unknown if NULL */
+static bool run_cmd(cmd_element_t *next_cmd, int argc, char *argv[])
 {
-    if (argc == 0)
-        return true;
-    /* Try to find matching command */
-    cmd_element_t *next_cmd = cmd_list;
     bool ok = true;
-    while (next_cmd && strcmp(argv[0], next_cmd->name) != 0)
-        next_cmd = next_cmd->next;
     if (next_cmd) {
+        if (cmd_hook)
+            cmd_hook(next_cmd->name);
+        /* The command list is gone once quit has run */
+        const char *name = next_cmd->name;
+        bool logged = evlog_is_open();
+        evlog_sample_t before;
+        if (logged)
+            evlog_sample(&before);
+        mem_counts_t mem_before, mem_after;
+        mem_counts(&mem_before);
+        mem_mark_t mark = mem_peak_mark();
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
         ok = next_cmd->operation(argc, argv);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        size_t peak = mem_peak_rise(mark);
+        mem_counts(&mem_after);
+        if (cmd_hook)
+            cmd_hook(NULL);
+        if (logged) {
+            int64_t start_ns = (int64_t) start.tv_sec * 1000000000 +
+                               start.tv_nsec;
+            int64_t end_ns = (int64_t) end.tv_sec * 1000000000 + end.tv_nsec;
+            evlog_command(name, argc, argv, ok, start_ns,
+                          end_ns - start_ns, &before);
+        }
+        /* Commands are gone once quit has run */
+        if (!quit_flag) {
+            record_latency(next_cmd, &start, &end);
+            record_mem(next_cmd, &mem_before, &mem_after, peak);
+        }
         if (!ok)
             record_error();
     } else {
@@ -190,6 +410,14 @@ static bool interpret_cmda(int argc, char *argv[])
     return ok;
 }
 
+/* Execute a command that has already been split into arguments */
+static bool interpret_cmda(int argc, char *argv[])
+{
+    if (argc == 0)
+        return true;
+    return run_cmd(name_find(&cmd_table, argv[0]), argc, argv);
+}
+
 /* Execute a command from a command line */
 static bool interpret_cmd(char *cmdline)
 {
@@ -198,12 +426,7 @@ static bool interpret_cmd(char *cmdline)
 
     int argc;
     char **argv = parse_args(cmdline, &argc);
-    bool ok = interpret_cmda(argc, argv);
-    for (int i = 0; i < argc; i++)
-        free_string(argv[i]);
-    free_array(argv, argc, sizeof(char *));
-
-    return ok;
+    return interpret_cmda(argc, argv);
 }
 
 /* Set function to be executed as part of program exit */
@@ -229,6 +452,7 @@ static bool do_quit(int argc, char *argv[])
     while (c) {
         cmd_element_t *ele = c;
         c = c->next;
+        hist_free(ele->latency);
         free_block(ele, sizeof(cmd_element_t));
     }
 
@@ -238,6 +462,8 @@ static bool do_quit(int argc, char *argv[])
         p = p->next;
         free_block(ele, sizeof(param_element_t));
     }
+    name_clear(&cmd_table);
+    name_clear(&param_table);
 
     while (buf_stack)
         pop_file();
@@ -320,17 +546,14 @@ static bool do_option(int argc, char *argv[])
             report(1, "Cannot parse '%s' as integer", argv[i]);
             return false;
         }
-        /* Find parameter in list */
-        param_element_t *plist = param_list;
-        while (!found && plist) {
-            if (strcmp(plist->name, name) == 0) {
-                int oldval = *plist->valp;
-                *plist->valp = value;
-                if (plist->setter)
-                    plist->setter(oldval);
-                found = true;
-            } else
-                plist = plist->next;
+        /* Find parameter */
+        param_element_t *param = name_find(&param_table, name);
+        if (param) {
+            int oldval = *param->valp;
+            *param->valp = value;
+            if (param->setter)
+                param->setter(oldval);
+            found = true;
         }
         /* Didn't find parameter */
         if (!found) {
@@ -357,6 +580,169 @@ static bool do_source(int argc, char *argv[])
     return true;
 }
 
+/* State of the compile command */
+typedef struct {
+    name_table_t index; /* Maps each string to its index + 1 */
+    char **strs;
+    size_t n_strs, strs_size;
+    size_t strs_len; /* Bytes the strings take in the file */
+    uint32_t *code;
+    size_t n_code, code_size;
+} compiler_t;
+
+static void compile_word(compiler_t *c, uint32_t w)
+{
+    if (c->n_code == c->code_size) {
+        size_t size = c->code_size ? 2 * c->code_size : 1024;
+        uint32_t *code = malloc_or_fail(size * sizeof(uint32_t), "compile");
+        if (c->code) {
+            memcpy(code, c->code, c->n_code * sizeof(uint32_t));
+            free_array(c->code, c->code_size, sizeof(uint32_t));
+        }
+        c->code = code;
+        c->code_size = size;
+    }
+    c->code[c->n_code++] = w;
+}
+
+/* Return the index of string s, adding it on first use */
+static uint32_t compile_string(compiler_t *c, const char *s)
+{
+    void *ele = name_find(&c->index, s);
+    if (ele)
+        return (uintptr_t) ele - 1;
+
+    if (c->n_strs == c->strs_size) {
+        size_t size = c->strs_size ? 2 * c->strs_size : 256;
+        char **strs = malloc_or_fail(size * sizeof(char *), "compile");
+        if (c->strs) {
+            memcpy(strs, c->strs, c->n_strs * sizeof(char *));
+            free_array(c->strs, c->strs_size, sizeof(char *));
+        }
+        c->strs = strs;
+        c->strs_size = size;
+    }
+    char *copy = strsave_or_fail(s, "compile");
+    c->strs[c->n_strs] = copy;
+    c->strs_len += strlen(copy) + 1;
+    name_add(&c->index, copy, (void *) (uintptr_t) (c->n_strs + 1));
+    return c->n_strs++;
+}
+
+/* Compile a line, split into arguments as parse_args does */
+static void compile_line(compiler_t *c, char *line, char *tmp)
+{
+    compile_word(c, compile_string(c, line));
+
+    uint32_t argc = split_words(line, tmp, NULL);
+    compile_word(c, argc);
+    for (char *arg = tmp; argc--; arg += strlen(arg) + 1)
+        compile_word(c, compile_string(c, arg));
+}
+
+static bool write_full(int fd, const void *p, size_t len)
+{
+    const char *b = p;
+    while (len > 0) {
+        ssize_t n = write(fd, b, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return false;
+        b += n;
+        len -= n;
+    }
+    return true;
+}
+
+static bool compile_write(const compiler_t *c, const char *fname)
+{
+    int fd = open(fname, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0)
+        return false;
+
+    size_t pad = -c->strs_len % sizeof(uint32_t);
+    prog_header_t h = {
+        .n_strs = c->n_strs,
+        .strs_len = c->strs_len + pad,
+        .n_code = c->n_code,
+    };
+    bool ok = write_full(fd, PROG_MAGIC, PROG_MAGIC_LEN) &&
+              write_full(fd, &h, sizeof(h));
+    for (size_t i = 0; ok && i < c->n_strs; i++)
+        ok = write_full(fd, c->strs[i], strlen(c->strs[i]) + 1);
+    ok = ok && write_full(fd, "\0\0\0", pad) &&
+         write_full(fd, c->code, c->n_code * sizeof(uint32_t));
+    return !close(fd) && ok;
+}
+
+static bool do_compile(int argc, char *argv[])
+{
+    if (argc != 3) {
+        report(1, "%s needs a script and an output file", argv[0]);
+        return false;
+    }
+
+    int fd = open(argv[1], O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) || !S_ISREG(st.st_mode)) {
+        report(1, "Could not open source file '%s'", argv[1]);
+        if (fd >= 0)
+            close(fd);
+        return false;
+    }
+
+    /* Lines are terminated in place, and split into tmp */
+    size_t len = st.st_size;
+    char *text = malloc_or_fail(len + 1, "compile");
+    char *tmp = malloc_or_fail(len + 1, "compile");
+    bool ok = true;
+    for (size_t got = 0; ok && got < len;) {
+        ssize_t n = read(fd, text + got, len - got);
+        if (n < 0 && errno == EINTR)
+            continue;
+        ok = n > 0;
+        got += n > 0 ? n : 0;
+    }
+    close(fd);
+    text[len] = '\0';
+
+    compiler_t c;
+    memset(&c, 0, sizeof(c));
+    size_t lines = 0;
+    for (char *line = text; ok && line < text + len; lines++) {
+        char *end = memchr(line, '\n', text + len - line);
+        if (!end)
+            end = text + len;
+        *end = '\0';
+        compile_line(&c, line, tmp);
+        line = end + 1;
+    }
+
+    if (!ok)
+        report(1, "Could not read source file '%s'", argv[1]);
+    else if (c.n_strs > UINT32_MAX || c.n_code > UINT32_MAX ||
+             c.strs_len > UINT32_MAX - sizeof(uint32_t)) {
+        report(1, "Script '%s' is too large", argv[1]);
+        ok = false;
+    } else if (!(ok = compile_write(&c, argv[2])))
+        report(1, "Could not write compiled script '%s'", argv[2]);
+    else
+        report(1, "Compiled %lu lines into '%s'", (unsigned long) lines,
+               argv[2]);
+
+    for (size_t i = 0; i < c.n_strs; i++)
+        free_string(c.strs[i]);
+    if (c.strs)
+        free_array(c.strs, c.strs_size, sizeof(char *));
+    if (c.code)
+        free_array(c.code, c.code_size, sizeof(uint32_t));
+    name_clear(&c.index);
+    free_block(text, len + 1);
+    free_block(tmp, len + 1);
+    return ok;
+}
+
 static bool do_log(int argc, char *argv[])
 {
     if (argc < 2) {
@@ -391,6 +777,69 @@ static bool do_time(int argc, char *argv[])
     return ok;
 }
 
+static bool do_stats(int argc, char *argv[])
+{
+    if (argc > 2 || (argc == 2 && strcmp(argv[1], "reset"))) {
+        report(1, "%s takes no arguments or 'reset'", argv[0]);
+        return false;
+    }
+
+    if (argc == 2) {
+        for (cmd_element_t *c = cmd_list; c; c = c->next) {
+            if (c->latency)
+                hist_reset(c->latency);
+        }
+        return true;
+    }
+
+    report(1, "%-12s %10s %10s %10s %10s %10s %10s %10s", "usec", "count",
+           "mean", "p50", "p90", "p99", "p999", "max");
+    for (cmd_element_t *c = cmd_list; c; c = c->next) {
+        hist_t *h = c->latency;
+        if (!h || !hist_count(h))
+            continue;
+        report(1, "%-12s %10lu %10.2f %10.2f %10.2f %10.2f %10.2f %10.2f",
+               c->name, (unsigned long) hist_count(h), hist_mean(h) / 1000,
+               hist_quantile(h, 0.5) / 1000.0, hist_quantile(h, 0.9) / 1000.0,
+               hist_quantile(h, 0.99) / 1000.0,
+               hist_quantile(h, 0.999) / 1000.0, hist_max(h) / 1000.0);
+    }
+    return true;
+}
+
+static bool do_mem(int argc, char *argv[])
+{
+    if (argc > 2 || (argc == 2 && strcmp(argv[1], "reset"))) {
+        report(1, "%s takes no arguments or 'reset'", argv[0]);
+        return false;
+    }
+
+    if (argc == 2) {
+        for (cmd_element_t *c = cmd_list; c; c = c->next)
+            memset(&c->mem, 0, sizeof(c->mem));
+        return true;
+    }
+
+    mem_counts_t m;
+    mem_counts(&m);
+    report(1, "%lu allocations, %lu frees, %lu bytes in use, %lu at peak",
+           (unsigned long) m.allocs, (unsigned long) m.frees,
+           (unsigned long) m.current_bytes, (unsigned long) m.peak_bytes);
+    report(1, "%-12s %10s %10s %10s %12s %12s %12s", "per run", "runs",
+           "allocs", "frees", "bytes", "freed", "max peak");
+    for (cmd_element_t *c = cmd_list; c; c = c->next) {
+        const cmd_mem_t *cm = &c->mem;
+        if (!cm->runs || (!cm->allocs && !cm->frees))
+            continue;
+        double runs = cm->runs;
+        report(1, "%-12s %10lu %10.2f %10.2f %12.1f %12.1f %12lu", c->name,
+               (unsigned long) cm->runs, cm->allocs / runs, cm->frees / runs,
+               cm->alloc_bytes / runs, cm->free_bytes / runs,
+               (unsigned long) cm->peak);
+    }
+    return true;
+}
+
 static bool use_linenoise = true;
 static int web_fd;
 
@@ -404,7 +853,9 @@ static bool do_web(int argc, char *argv[])
 
     web_fd = web_open(port);
     if (web_fd > 0) {
+        report_flush();
         printf("listen on port %d, fd is %d\n", port, web_fd);
+        fflush(stdout);
         line_set_eventmux_callback(web_eventmux);
         use_linenoise = false;
     } else {
@@ -419,6 +870,8 @@ void init_cmd()
 {
     cmd_list = NULL;
     param_list = NULL;
+    name_clear(&cmd_table);
+    name_clear(&param_table);
     err_cnt = 0;
     quit_flag = false;
 
@@ -428,8 +881,15 @@ void init_cmd()
                 "[name val]");
     ADD_COMMAND(quit, "Exit program", "");
     ADD_COMMAND(source, "Read commands from source file", "");
+    ADD_COMMAND(compile, "Compile source file for source to run faster",
+                "infile outfile");
     ADD_COMMAND(log, "Copy output to file", "file");
     ADD_COMMAND(time, "Time command execution", "cmd arg ...");
+    ADD_COMMAND(mem, "Show allocations of each command run, or clear them",
+                "[reset]");
+    ADD_COMMAND(stats,
+                "Show latency percentiles of each command run, or clear them",
+                "[reset]");
     ADD_COMMAND(web, "Read commands from builtin web server", "[port]");
     add_cmd("#", do_comment_cmd, "Display comment", "...");
     add_param("simulation", &simulation, "Start/Stop simulation mode", NULL);
@@ -443,6 +903,92 @@ void init_cmd()
     first_time = last_time;
 }
 
+/* Release a compiled script set up by prog_load */
+static void prog_free(prog_t *prog)
+{
+    uint32_t n = prog->n_strs + 1;
+    if (prog->strs)
+        free_array(prog->strs, n, sizeof(char *));
+    if (prog->lens)
+        free_array(prog->lens, n, sizeof(uint32_t));
+    if (prog->cmds)
+        free_array(prog->cmds, n, sizeof(cmd_element_t *));
+    if (prog->argv)
+        free_array(prog->argv, prog->max_argc + 1, sizeof(char *));
+    if (prog->args)
+        free_block(prog->args, prog->args_size + 1);
+    free_block(prog, sizeof(prog_t));
+}
+
+/* Check the compiled script mapped by rio and set it up to be run.
+ * Return NULL if it is invalid.
+ */
+static prog_t *prog_load(const rio_t *rio)
+{
+    prog_header_t h;
+    size_t len = rio->map_len - PROG_MAGIC_LEN;
+    if (len < sizeof(h))
+        return NULL;
+    memcpy(&h, rio->map + PROG_MAGIC_LEN, sizeof(h));
+    len -= sizeof(h);
+    /* Every string takes at least its terminator */
+    if (h.strs_len % sizeof(uint32_t) || h.strs_len > len ||
+        h.n_strs > h.strs_len ||
+        (size_t) h.n_code * sizeof(uint32_t) != len - h.strs_len)
+        return NULL;
+
+    prog_t *prog = calloc_or_fail(1, sizeof(prog_t), "prog_load");
+    uint32_t n = h.n_strs + 1;
+    prog->n_strs = h.n_strs;
+    prog->strs = calloc_or_fail(n, sizeof(char *), "prog_load");
+    prog->lens = calloc_or_fail(n, sizeof(uint32_t), "prog_load");
+    prog->cmds = calloc_or_fail(n, sizeof(cmd_element_t *), "prog_load");
+
+    char *p = rio->map + PROG_MAGIC_LEN + sizeof(h);
+    char *strs_end = p + h.strs_len;
+    for (uint32_t i = 0; i < h.n_strs; i++) {
+        char *nul = memchr(p, '\0', strs_end - p);
+        if (!nul)
+            goto bad;
+        prog->strs[i] = p;
+        prog->lens[i] = nul - p;
+        p = nul + 1;
+    }
+
+    /* The mapping is page-aligned, and so is the code within it */
+    const uint32_t *code = (const uint32_t *) strs_end;
+    prog->pc = code;
+    prog->end = code + h.n_code;
+    for (const uint32_t *pc = code; pc < prog->end;) {
+        if (prog->end - pc < 2 || pc[0] >= h.n_strs ||
+            pc[1] > (size_t) (prog->end - pc - 2))
+            goto bad;
+        uint32_t argc = pc[1];
+        size_t size = 0;
+        for (uint32_t i = 0; i < argc; i++) {
+            if (pc[2 + i] >= h.n_strs)
+                goto bad;
+            size += prog->lens[pc[2 + i]] + 1;
+        }
+        if (argc && !prog->cmds[pc[2]])
+            prog->cmds[pc[2]] = name_find(&cmd_table, prog->strs[pc[2]]);
+        if (argc > prog->max_argc)
+            prog->max_argc = argc;
+        if (size > prog->args_size)
+            prog->args_size = size;
+        pc += 2 + argc;
+    }
+
+    prog->argv =
+        calloc_or_fail(prog->max_argc + 1, sizeof(char *), "prog_load");
+    prog->args = malloc_or_fail(prog->args_size + 1, "prog_load");
+    return prog;
+
+bad:
+    prog_free(prog);
+    return NULL;
+}
+
 /* Create new buffer for named file.
  * Name == NULL for stdin.
  * Return true if successful.
@@ -461,6 +1007,30 @@ static bool push_file(char *fname)
     rnew->fd = fd;
     rnew->count = 0;
     rnew->bufptr = rnew->buf;
+    rnew->map = NULL;
+    rnew->map_pos = 0;
+    rnew->prog = NULL;
+
+    struct stat st;
+    if (fname && !fstat(fd, &st) && S_ISREG(st.st_mode) && st.st_size > 0) {
+        char *map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            madvise(map, st.st_size, MADV_SEQUENTIAL);
+            rnew->map = map;
+            rnew->map_len = st.st_size;
+        }
+    }
+
+    if (rnew->map && rnew->map_len >= PROG_MAGIC_LEN &&
+        !memcmp(rnew->map, PROG_MAGIC, PROG_MAGIC_LEN) &&
+        !(rnew->prog = prog_load(rnew))) {
+        report(1, "Invalid compiled script '%s'", fname);
+        munmap(rnew->map, rnew->map_len);
+        close(fd);
+        free_block(rnew, sizeof(rio_t));
+        return false;
+    }
     rnew->prev = buf_stack;
     buf_stack = rnew;
 
@@ -473,6 +1043,10 @@ static void pop_file()
     if (buf_stack) {
         rio_t *rsave = buf_stack;
         buf_stack = rsave->prev;
+        if (rsave->prog)
+            prog_free(rsave->prog);
+        if (rsave->map)
+            munmap(rsave->map, rsave->map_len);
         close(rsave->fd);
         free_block(rsave, sizeof(rio_t));
     }
@@ -484,6 +1058,61 @@ static void init_in()
     buf_stack = NULL;
 }
 
+/* Return the next line of a mapped file, without its newline */
+static char *readline_mapped(rio_t *rio)
+{
+    char *line = rio->map + rio->map_pos;
+    size_t left = rio->map_len - rio->map_pos;
+    char *end = memchr(line, '\n', left);
+    if (end) {
+        *end = '\0';
+        rio->map_pos += end - line + 1;
+    } else {
+        /* Last line did not terminate with newline, and may fill its page */
+        size_t len = left < RIO_BUFSIZE - 1 ? left : RIO_BUFSIZE - 1;
+        memcpy(linebuf, line, len);
+        linebuf[len] = '\0';
+        line = linebuf;
+        rio->map_pos = rio->map_len;
+    }
+
+    if (echo) {
+        report_noreturn(1, prompt);
+        report(1, "%s", line);
+    }
+    return line;
+}
+
+/* Run the next line of the compiled script on top of the stack.  At its end,
+ * pop the script instead.
+ */
+static void prog_step()
+{
+    prog_t *prog = buf_stack->prog;
+    if (prog->pc == prog->end) {
+        pop_file();
+        return;
+    }
+
+    const uint32_t *pc = prog->pc;
+    int argc = pc[1];
+    prog->pc += 2 + argc;
+    if (echo) {
+        report_noreturn(1, prompt);
+        report(1, "%s", prog->strs[pc[0]]);
+    }
+    if (quit_flag || !argc)
+        return;
+
+    char *dst = prog->args;
+    for (int i = 0; i < argc; i++) {
+        uint32_t s = pc[2 + i];
+        prog->argv[i] = memcpy(dst, prog->strs[s], prog->lens[s] + 1);
+        dst += prog->lens[s] + 1;
+    }
+    run_cmd(prog->cmds[pc[2]], argc, prog->argv);
+}
+
 /* Read command from input file.
  * When hit EOF, close that file and return NULL
  */
@@ -495,9 +1124,17 @@ static char *readline()
     if (!buf_stack)
         return NULL;
 
+    if (buf_stack->map) {
+        if (buf_stack->map_pos < buf_stack->map_len)
+            return readline_mapped(buf_stack);
+        pop_file();
+        return NULL;
+    }
+
     for (int cnt = 0; cnt < RIO_BUFSIZE - 2; cnt++) {
         if (buf_stack->count <= 0) {
             /* Need to read from input file */
+            before_input();
             buf_stack->count = read(buf_stack->fd, buf_stack->buf, RIO_BUFSIZE);
             buf_stack->bufptr = buf_stack->buf;
             if (buf_stack->count <= 0) {
@@ -582,11 +1219,14 @@ static int cmd_select(int nfds,
             FD_SET(web_fd, readfds);
 
         if (infd == STDIN_FILENO && prompt_flag) {
+            before_input();
             char *cmdline = linenoise(prompt);
             if (cmdline)
                 interpret_cmd(cmdline);
             fflush(stdout);
             prompt_flag = true;
+        } else if (buf_stack->prog) {
+            prog_step();
         } else if (infd != STDIN_FILENO) {
             char *cmdline = readline();
             if (cmdline)
@@ -602,6 +1242,13 @@ bool finish_cmd()
     if (!quit_flag)
         ok = ok && do_quit(0, NULL);
     has_infile = false;
+    if (arg_buf) {
+        free_block(arg_buf, arg_buf_size);
+        free_array(arg_vec, arg_vec_size, sizeof(char *));
+        arg_buf = NULL;
+        arg_vec = NULL;
+        arg_buf_size = arg_vec_size = 0;
+    }
     return ok && err_cnt == 0;
 }
 
@@ -655,6 +1302,7 @@ bool run_console(char *infile_name)
 
     if (!has_infile) {
         char *cmdline;
+        before_input();
         while (use_linenoise && (cmdline = linenoise(prompt))) {
             interpret_cmd(cmdline);
             line_history_add(cmdline);       /* Add to the history. */
@@ -663,6 +1311,7 @@ bool run_console(char *infile_name)
             while (buf_stack && buf_stack->fd != STDIN_FILENO)
                 cmd_select(0, NULL, NULL, NULL, NULL);
             has_infile = false;
+            before_input();
         }
         if (!use_linenoise) {
             while (!cmd_done())
@@ -4,6 +4,7 @@
 #include <stdbool.h>
 #include <sys/select.h>
 
+#include "hist.h"
 #include "linenoise.h"
 
 #define HISTORY_FILE ".cmd_history"
@@ -16,6 +17,14 @@ extern int simulation;
 /* Each command defined in terms of a function */
 typedef bool (*cmd_func_t)(int argc, char *argv[]);
 
+/* Memory used by the runs of a command */
+typedef struct {
+    size_t runs;
+    size_t allocs, frees;
+    size_t alloc_bytes, free_bytes;
+    size_t peak; /* Largest rise of memory in use during one run */
+} cmd_mem_t;
+
 /* Information about each command */
 
 /* Organized as linked list in alphabetical order */
@@ -24,6 +33,8 @@ typedef struct __cmd_element {
     cmd_func_t operation;
     char *summary;
     char *param;
+    hist_t *latency; /* Nanoseconds taken by each run, NULL before any */
+    cmd_mem_t mem;
     struct __cmd_element *next;
 } cmd_element_t;
 
@@ -53,6 +64,20 @@ void add_param(char *name, int *valp, char *summary, setter_func_t setter);
 /* Extract integer from text and store at loc */
 bool get_int(char *vname, int *loc);
 
+/* Function called with the name of each command before it runs, and with
+ * NULL once it has finished
+ */
+typedef void (*cmd_hook_t)(const char *name);
+
+/* Set the function called around commands, NULL for none */
+void set_cmd_hook(cmd_hook_t hook);
+
+/* Function called before the console waits for input */
+typedef void (*idle_hook_t)();
+
+/* Set the function called before waiting for input, NULL for none */
+void set_idle_hook(idle_hook_t hook);
+
 /* Add function to be executed as part of program exit */
 void add_quit_helper(cmd_func_t qf);
 
@@ -0,0 +1,249 @@
+/* Binary log of commands and events */
+
+/* PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP is a GNU extension */
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "evlog.h"
+
+/* Other systems spell it without the suffix */
+#ifndef PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP
+#define PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP PTHREAD_RECURSIVE_MUTEX_INITIALIZER
+#endif
+
+/* Size of the buffer collecting records between writes */
+#define EVLOG_BUFSIZE 65536
+
+/* Command names given an id, found by hashing their address */
+#define NAME_SLOTS 512
+
+static int evlog_fd = -1;
+static unsigned char evlog_buf[EVLOG_BUFSIZE];
+static size_t buf_len = 0;
+
+/* Time of the previous record */
+static int64_t last_ns;
+
+static const char *names[NAME_SLOTS];
+static unsigned name_ids[NAME_SLOTS];
+static unsigned name_count = 0;
+
+static evlog_probe_t evlog_probe = NULL;
+
+/* Worker threads may report events, and so may a signal handler while a
+ * record is being appended
+ */
+static pthread_mutex_t evlog_lock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+
+static int64_t clock_ns(clockid_t clock)
+{
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static bool write_all(const unsigned char *p, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = write(evlog_fd, p, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return false;
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+/* Write the buffer out.  On failure the log is closed and false returned */
+static bool flush_buf()
+{
+    bool ok = write_all(evlog_buf, buf_len);
+    buf_len = 0;
+    if (!ok) {
+        close(evlog_fd);
+        evlog_fd = -1;
+    }
+    return ok;
+}
+
+/* Make room for len bytes, return false if the log failed */
+static bool reserve(size_t len)
+{
+    return buf_len + len <= EVLOG_BUFSIZE || flush_buf();
+}
+
+static void put_varint(uint64_t v)
+{
+    while (v >= 0x80) {
+        evlog_buf[buf_len++] = (v & 0x7f) | 0x80;
+        v >>= 7;
+    }
+    evlog_buf[buf_len++] = v;
+}
+
+static uint64_t zigzag(int64_t v)
+{
+    return ((uint64_t) v << 1) ^ (uint64_t) (v >> 63);
+}
+
+/* Append a length and its bytes, writing long strings directly */
+static bool put_string(const char *s, size_t len)
+{
+    if (!reserve(10))
+        return false;
+    put_varint(len);
+    if (len > EVLOG_BUFSIZE - buf_len) {
+        if (!flush_buf())
+            return false;
+        if (!write_all((const unsigned char *) s, len)) {
+            close(evlog_fd);
+            evlog_fd = -1;
+            return false;
+        }
+        return true;
+    }
+    memcpy(evlog_buf + buf_len, s, len);
+    buf_len += len;
+    return true;
+}
+
+/* Append the fixed start of a record, with room for count more varints */
+static bool put_head(evlog_rec_t type, int64_t ns, int count)
+{
+    if (!reserve(1 + 10 * (count + 1)))
+        return false;
+    evlog_buf[buf_len++] = type;
+    put_varint(zigzag(ns - last_ns));
+    last_ns = ns;
+    return true;
+}
+
+/* Return the id of name, recording it on first use, or -1 on failure */
+static int64_t name_id(const char *name)
+{
+    size_t h = ((uintptr_t) name >> 3) % NAME_SLOTS;
+    while (names[h]) {
+        if (names[h] == name)
+            return name_ids[h];
+        h = (h + 1) % NAME_SLOTS;
+    }
+    /* Keep a free slot to end the search */
+    if (name_count + 1 >= NAME_SLOTS || !reserve(1 + 10))
+        return -1;
+
+    unsigned id = name_count++;
+    evlog_buf[buf_len++] = EVLOG_NAME;
+    put_varint(id);
+    if (!put_string(name, strlen(name)))
+        return -1;
+    names[h] = name;
+    name_ids[h] = id;
+    return id;
+}
+
+bool evlog_open(const char *path)
+{
+    static bool registered = false;
+
+    evlog_close();
+    evlog_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (evlog_fd < 0)
+        return false;
+
+    if (!registered) {
+        atexit(evlog_close);
+        registered = true;
+    }
+    memset(names, 0, sizeof(names));
+    name_count = 0;
+    last_ns = clock_ns(CLOCK_MONOTONIC);
+    memcpy(evlog_buf, EVLOG_MAGIC, EVLOG_MAGIC_LEN);
+    buf_len = EVLOG_MAGIC_LEN;
+    put_varint(clock_ns(CLOCK_REALTIME));
+    return true;
+}
+
+bool evlog_is_open()
+{
+    return evlog_fd >= 0;
+}
+
+void evlog_set_probe(evlog_probe_t probe)
+{
+    evlog_probe = probe;
+}
+
+void evlog_sample(evlog_sample_t *s)
+{
+    s->qid = -1;
+    s->blocks = 0;
+    if (evlog_probe)
+        evlog_probe(s);
+    mem_counts(&s->mem);
+}
+
+void evlog_command(const char *name,
+                   int argc,
+                   char *argv[],
+                   bool ok,
+                   int64_t start_ns,
+                   int64_t dur_ns,
+                   const evlog_sample_t *before)
+{
+    evlog_sample_t after;
+    evlog_sample(&after);
+
+    pthread_mutex_lock(&evlog_lock);
+    if (evlog_fd < 0)
+        goto out;
+    int64_t id = name_id(name);
+    if (id < 0 || !put_head(EVLOG_CMD, start_ns, 3))
+        goto out;
+    put_varint(id);
+    put_varint(before->qid + 1);
+    put_varint(argc > 0 ? argc - 1 : 0);
+    for (int i = 1; i < argc; i++) {
+        if (!put_string(argv[i], strlen(argv[i])))
+            goto out;
+    }
+    if (!reserve(1 + 6 * 10))
+        goto out;
+    evlog_buf[buf_len++] = ok;
+    put_varint(dur_ns > 0 ? dur_ns : 0);
+    put_varint(zigzag((int64_t) (after.blocks - before->blocks)));
+    put_varint(after.mem.allocs - before->mem.allocs);
+    put_varint(after.mem.frees - before->mem.frees);
+    put_varint(after.mem.alloc_bytes - before->mem.alloc_bytes);
+    put_varint(after.mem.free_bytes - before->mem.free_bytes);
+out:
+    pthread_mutex_unlock(&evlog_lock);
+}
+
+void evlog_event(int msg, const char *text, size_t len)
+{
+    pthread_mutex_lock(&evlog_lock);
+    if (evlog_fd >= 0 && put_head(EVLOG_EVENT, clock_ns(CLOCK_MONOTONIC), 1)) {
+        put_varint(msg);
+        put_string(text, len);
+    }
+    pthread_mutex_unlock(&evlog_lock);
+}
+
+void evlog_close()
+{
+    pthread_mutex_lock(&evlog_lock);
+    if (evlog_fd >= 0 && flush_buf()) {
+        close(evlog_fd);
+        evlog_fd = -1;
+    }
+    pthread_mutex_unlock(&evlog_lock);
+}
@@ -0,0 +1,70 @@
+#ifndef LAB0_EVLOG_H
+#define LAB0_EVLOG_H
+
+/* Binary log of dispatched commands and reported events, for offline
+ * analysis with scripts/evlog.py.
+ *
+ * The file starts with EVLOG_MAGIC, whose last byte is the format version,
+ * and the wall-clock time of opening in nanoseconds as a varint.  Each record
+ * is a type byte followed by varints; times are nanoseconds since the
+ * previous record, and signed values are zigzag-encoded.
+ *   EVLOG_NAME:  id, length, name bytes.  Precedes the first use of a name.
+ *   EVLOG_CMD:   time, name id, queue id + 1 (0: none), argument count, then
+ *                length and bytes of each argument, result, duration,
+ *                change in allocated blocks, then the allocations, frees,
+ *                bytes allocated and bytes freed during the command.
+ *   EVLOG_EVENT: time, message type (message_t), length, text bytes.
+ * Records are buffered and written when the buffer fills or the log closes.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "report.h"
+
+#define EVLOG_MAGIC "LAB0EVL\2"
+#define EVLOG_MAGIC_LEN 8
+
+typedef enum { EVLOG_NAME, EVLOG_CMD, EVLOG_EVENT, N_EVLOG_REC } evlog_rec_t;
+
+/* State of the program sampled around each command */
+typedef struct {
+    int qid;          /* Current queue, or -1 */
+    size_t blocks;    /* Allocated blocks */
+    mem_counts_t mem; /* Filled in by evlog_sample itself */
+} evlog_sample_t;
+
+/* Function filling in a sample */
+typedef void (*evlog_probe_t)(evlog_sample_t *s);
+
+/* Create or truncate the log at path.  Return false if it cannot be opened */
+bool evlog_open(const char *path);
+
+/* Return whether a log is open */
+bool evlog_is_open();
+
+/* Set the function sampling the program around commands */
+void evlog_set_probe(evlog_probe_t probe);
+
+/* Sample the program state, as passed to evlog_command */
+void evlog_sample(evlog_sample_t *s);
+
+/* Record a command that started at start_ns on CLOCK_MONOTONIC, ran for
+ * dur_ns and returned ok.  before is the sample taken before it ran.
+ */
+void evlog_command(const char *name,
+                   int argc,
+                   char *argv[],
+                   bool ok,
+                   int64_t start_ns,
+                   int64_t dur_ns,
+                   const evlog_sample_t *before);
+
+/* Record a message reported through report_event */
+void evlog_event(int msg, const char *text, size_t len);
+
+/* Write buffered records and close the log */
+void evlog_close();
+
+#endif /* LAB0_EVLOG_H */
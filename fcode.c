@@ -0,0 +1,238 @@
+/* Front-coded storage of sorted strings */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "fcode.h"
+#include "harness.h"
+#include "queue.h"
+
+/* Strings per block.  Each block restarts with a whole string, so a removal
+ * at either end decodes at most one block.
+ */
+#define FCODE_BLOCK 16
+
+typedef struct {
+    unsigned char *data;
+    size_t len;
+    unsigned count;
+} fcode_block_t;
+
+struct __fcode {
+    fcode_block_t *blocks;
+    size_t nblocks;
+    size_t first, last; /* Live blocks are [first, last) */
+    size_t count;
+    size_t max_len;
+    char *buf; /* Room for the longest string, to decode into */
+};
+
+static size_t varint_len(size_t v)
+{
+    size_t n = 1;
+    while (v >= 0x80) {
+        v >>= 7;
+        n++;
+    }
+    return n;
+}
+
+static unsigned char *put_varint(unsigned char *p, size_t v)
+{
+    while (v >= 0x80) {
+        *p++ = (v & 0x7f) | 0x80;
+        v >>= 7;
+    }
+    *p++ = v;
+    return p;
+}
+
+static const unsigned char *get_varint(const unsigned char *p, size_t *v)
+{
+    *v = 0;
+    for (int shift = 0;; shift += 7) {
+        *v |= (size_t) (*p & 0x7f) << shift;
+        if (!(*p++ & 0x80))
+            return p;
+    }
+}
+
+static size_t common_prefix(const char *a, const char *b)
+{
+    size_t n = 0;
+    while (a[n] && a[n] == b[n])
+        n++;
+    return n;
+}
+
+/* Decode the entry at p into buf, which holds its predecessor.
+ * Return the following entry.
+ */
+static const unsigned char *decode_entry(const unsigned char *p, char *buf)
+{
+    size_t shared, suffix;
+    p = get_varint(p, &shared);
+    p = get_varint(p, &suffix);
+    memcpy(buf + shared, p, suffix);
+    buf[shared + suffix] = '\0';
+    return p + suffix;
+}
+
+/* Encode the n strings of strs as block b */
+static bool encode_block(fcode_block_t *b, const char **strs, unsigned n)
+{
+    size_t len = 0;
+    for (unsigned i = 0; i < n; i++) {
+        size_t shared = i ? common_prefix(strs[i - 1], strs[i]) : 0;
+        size_t suffix = strlen(strs[i] + shared);
+        len += varint_len(shared) + varint_len(suffix) + suffix;
+    }
+
+    unsigned char *p = malloc(len);
+    if (!p)
+        return false;
+    b->data = p;
+    b->len = len;
+    b->count = n;
+
+    for (unsigned i = 0; i < n; i++) {
+        size_t shared = i ? common_prefix(strs[i - 1], strs[i]) : 0;
+        size_t suffix = strlen(strs[i] + shared);
+        p = put_varint(p, shared);
+        p = put_varint(p, suffix);
+        memcpy(p, strs[i] + shared, suffix);
+        p += suffix;
+    }
+    return true;
+}
+
+fcode_t *fcode_pack(struct list_head *head)
+{
+    size_t count = 0, max_len = 0;
+    element_t *e;
+    list_for_each_entry (e, head, list) {
+        size_t len = strlen(e->value);
+        if (len > max_len)
+            max_len = len;
+        count++;
+    }
+
+    fcode_t *f = malloc(sizeof(fcode_t));
+    if (!f)
+        return NULL;
+    f->nblocks = (count + FCODE_BLOCK - 1) / FCODE_BLOCK;
+    f->first = f->last = 0;
+    f->count = count;
+    f->max_len = max_len;
+    f->blocks = f->nblocks ? malloc(f->nblocks * sizeof(fcode_block_t)) : NULL;
+    f->buf = malloc(max_len + 1);
+    if ((f->nblocks && !f->blocks) || !f->buf) {
+        fcode_free(f);
+        return NULL;
+    }
+
+    const char *strs[FCODE_BLOCK];
+    unsigned n = 0;
+    list_for_each_entry (e, head, list) {
+        strs[n++] = e->value;
+        if (n < FCODE_BLOCK && e->list.next != head)
+            continue;
+        if (!encode_block(&f->blocks[f->last], strs, n)) {
+            fcode_free(f);
+            return NULL;
+        }
+        f->last++;
+        n = 0;
+    }
+    return f;
+}
+
+size_t fcode_count(const fcode_t *f)
+{
+    return f->count;
+}
+
+size_t fcode_bytes(const fcode_t *f)
+{
+    size_t bytes = sizeof(fcode_t) + f->nblocks * sizeof(fcode_block_t) +
+                   f->max_len + 1;
+    for (size_t i = f->first; i < f->last; i++)
+        bytes += f->blocks[i].len;
+    return bytes;
+}
+
+bool fcode_remove(fcode_t *f, bool tail, char *sp, size_t bufsize)
+{
+    if (!f->count)
+        return false;
+
+    fcode_block_t *b = &f->blocks[tail ? f->last - 1 : f->first];
+    const unsigned char *p = decode_entry(b->data, f->buf);
+    if (tail) {
+        /* Dropping the last entry is a matter of cutting the block short */
+        const unsigned char *start = b->data;
+        for (unsigned i = 1; i < b->count; i++) {
+            start = p;
+            p = decode_entry(p, f->buf);
+        }
+        b->len = start - b->data;
+    }
+
+    if (sp) {
+        size_t len = strlen(f->buf);
+        if (len > bufsize - 1)
+            len = bufsize - 1;
+        memcpy(sp, f->buf, len);
+        sp[len] = '\0';
+    }
+
+    if (!tail && b->count > 1) {
+        /* The second entry is stored relative to the removed one, so it
+         * becomes the whole string starting the block.  Its shared prefix
+         * was part of the removed entry, so it is rewritten in place and
+         * removals never allocate.
+         */
+        const unsigned char *rest = decode_entry(p, f->buf);
+        size_t slen = strlen(f->buf), rest_len = b->data + b->len - rest;
+        size_t head = varint_len(0) + varint_len(slen) + slen;
+        memmove(b->data + head, rest, rest_len);
+        unsigned char *q = put_varint(b->data, 0);
+        q = put_varint(q, slen);
+        memcpy(q, f->buf, slen);
+        b->len = head + rest_len;
+    }
+
+    f->count--;
+    if (--b->count == 0) {
+        free(b->data);
+        if (tail)
+            f->last--;
+        else
+            f->first++;
+    }
+    return true;
+}
+
+bool fcode_walk(fcode_t *f, fcode_visit_t visit, void *priv)
+{
+    for (size_t i = f->first; i < f->last; i++) {
+        const unsigned char *p = f->blocks[i].data;
+        for (unsigned j = 0; j < f->blocks[i].count; j++) {
+            p = decode_entry(p, f->buf);
+            if (!visit(f->buf, priv))
+                return false;
+        }
+    }
+    return true;
+}
+
+void fcode_free(fcode_t *f)
+{
+    if (!f)
+        return;
+    for (size_t i = f->first; i < f->last; i++)
+        free(f->blocks[i].data);
+    free(f->blocks);
+    free(f->buf);
+    free(f);
+}
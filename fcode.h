@@ -0,0 +1,49 @@
+#ifndef LAB0_FCODE_H
+#define LAB0_FCODE_H
+
+/* Front-coded storage of the strings of a sorted queue.
+ *
+ * Strings are grouped in small blocks.  The first string of a block is
+ * stored whole, every following one as the length of the prefix it shares
+ * with its predecessor and the remaining suffix, both lengths as varints.
+ * Neighbours in a sorted queue share long prefixes, so this stores far fewer
+ * bytes than one element and one heap string per value.  Strings can be
+ * visited in order and removed from either end without decoding the rest.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "list.h"
+
+typedef struct __fcode fcode_t;
+
+/* Encode the strings of queue, which should be sorted, in order.
+ * The queue is left untouched.  Return NULL for allocation failed.
+ */
+fcode_t *fcode_pack(struct list_head *head);
+
+/* Number of strings stored */
+size_t fcode_count(const fcode_t *f);
+
+/* Number of bytes used by the storage */
+size_t fcode_bytes(const fcode_t *f);
+
+/* Remove the first or, if tail is set, the last string and copy it to sp,
+ * up to a maximum of bufsize - 1 characters plus a null terminator, unless sp
+ * is NULL.  Return false if empty.
+ */
+bool fcode_remove(fcode_t *f, bool tail, char *sp, size_t bufsize);
+
+/* Function called on each string in order, returning false to stop */
+typedef bool (*fcode_visit_t)(const char *s, void *priv);
+
+/* Decode the strings in order through visit.
+ * Return false if visit stopped early.
+ */
+bool fcode_walk(fcode_t *f, fcode_visit_t visit, void *priv);
+
+/* Release the storage */
+void fcode_free(fcode_t *f);
+
+#endif /* LAB0_FCODE_H */
@@ -1,13 +1,22 @@
 /* Test support code */
 
+/* dladdr, used to name call sites, is a GNU extension */
+#define _GNU_SOURCE
+
+#include <dlfcn.h>
+#include <pthread.h>
 #include <setjmp.h>
+#include <stddef.h>
 #include <signal.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "random.h"
 #include "report.h"
 
 /* Our program needs to use regular malloc/free */
@@ -25,39 +34,124 @@
 /* Value at end of every block */
 #define MAGICFOOTER 0xbeefdead
 
+/* Value at start of blocks allocated in lite mode, which have no footer */
+#define MAGICLITE 0xfeedface
+
+/* Value at start of blocks placed against a guard page */
+#define MAGICGUARD 0xcafebabe
+
 /* Byte to fill newly malloced space with */
 #define FILLCHAR 0x55
 
 /* Data structures used by our code */
 
-/* Represent allocated blocks as doubly-linked list, with
- * next and prev pointers at beginning
- */
 typedef struct __block_element {
-    struct __block_element *next, *prev;
     size_t payload_size;
     size_t magic_header; /* Marker to see if block seems legitimate */
     unsigned char payload[0];
     /* Also place magic number at tail of every block */
 } block_element_t;
 
-static block_element_t *allocated = NULL;
-static size_t allocated_count = 0;
+/* Keep track of allocated blocks in open-addressing hash sets of their
+ * addresses, probed linearly, so that a block is validated and removed in
+ * constant time however many are allocated.  A set is kept at most half full
+ * and empty slots are NULL.
+ *
+ * Each thread registers the blocks it allocates in a cache of its own, whose
+ * address is stored past the footer of each block.  The lock of a cache is
+ * only contended when another thread frees one of its blocks.  A thread
+ * exiting leaves its cache, with any blocks still in it, to the next thread
+ * to start, so there are never more caches than threads once alive together.
+ */
+#define MIN_REGISTRY_SIZE 1024
+
+typedef struct __harness_cache {
+    block_element_t **registry;
+    size_t registry_size;
+    size_t allocated_count;
+    pthread_mutex_t lock;
+    struct __harness_cache *next;
+    struct __harness_cache *next_spare; /* In spare_caches */
+} harness_cache_t;
+
+/* Allocations made by one call site while one command was running, kept when
+ * profiling.  Blocks record their site so frees are credited to it.
+ */
+#define MEMPROF_BUCKETS 256
+
+typedef struct __memprof_site {
+    void *caller;
+    const char *tag; /* Command running, NULL outside any */
+    size_t allocs, frees;
+    size_t bytes;
+    size_t live, live_bytes;
+    struct __memprof_site *next;
+} memprof_site_t;
+
+int memprof_mode = 0;
+
+static memprof_site_t *memprof_table[MEMPROF_BUCKETS];
+static size_t memprof_nsites = 0;
+static const char *memprof_current = NULL;
+static pthread_mutex_t memprof_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static harness_cache_t *caches = NULL;
+static harness_cache_t *spare_caches = NULL; /* Left by exited threads */
+static pthread_mutex_t caches_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread harness_cache_t *local_cache = NULL;
+
+/* Key whose destructor returns the cache of an exiting thread */
+static pthread_key_t cache_key;
+static pthread_once_t cache_key_once = PTHREAD_ONCE_INIT;
+
+/* Blocks allocated in lite mode are only counted, atomically */
+static size_t lite_count = 0;
 
 /* Percent probability of malloc failure */
 int fail_probability = 0;
 
+/* Failures are drawn from a splitmix generator of each thread, seeded from
+ * fail_seed and the order in which threads first drew, or from the clock
+ * when fail_seed is 0.  Threads reseed when they find fail_epoch changed.
+ */
+int fail_seed = 0;
+static unsigned fail_epoch = 1;
+static unsigned fail_threads = 0;
+static __thread uint64_t fail_state;
+static __thread unsigned fail_state_epoch = 0;
+static __thread unsigned fail_thread = 0;
+
+int lite_mode = 0;
+int fill_mode = 1;
+
 static bool cautious_mode = true;
 static bool noallocate_mode = false;
-static bool error_occurred = false;
+static bool error_occurred = false; /* Accessed atomically */
 static char *error_message = "";
 
-static int time_limit = 1;
+/* Seconds a risky operation may take before raising an exception */
+int time_limit = 1;
 
 /* Data for managing exceptions */
 static jmp_buf env;
 static volatile sig_atomic_t jmp_ready = false;
-static bool time_limited = false;
+static volatile sig_atomic_t time_limited = false;
+
+/* In timer mode, a single interval timer set up on first use raises SIGALRM
+ * every TIMER_TICK_MS, and a risky operation only records its deadline, in
+ * place of two alarm() calls.  Nor does setting up save the signal mask: the
+ * mask found when the timer was armed is put back after an exception.
+ */
+#define TIMER_TICK_MS 100
+
+int timer_mode = 0;
+#ifdef __linux__
+static timer_t script_timer;
+#endif
+static bool timer_armed = false;
+static sigset_t timer_mask;
+static bool mask_saved = false; /* Whether env holds the signal mask */
+static volatile int64_t deadline_ns;
 
 /* For test_malloc and test_calloc */
 typedef enum {
@@ -70,8 +164,258 @@ typedef enum {
 /* Should this allocation fail? */
 static bool fail_allocation()
 {
-    double weight = (double) random() / RAND_MAX;
-    return (weight < 0.01 * fail_probability);
+    unsigned epoch = __atomic_load_n(&fail_epoch, __ATOMIC_RELAXED);
+    if (fail_state_epoch != epoch) {
+        if (!fail_thread)
+            fail_thread =
+                __atomic_add_fetch(&fail_threads, 1, __ATOMIC_RELAXED);
+        uint64_t seed = fail_seed;
+        if (!seed) {
+            struct timespec ts;
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            seed = (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+        }
+        fail_state = seed * fail_thread;
+        fail_state_epoch = epoch;
+    }
+
+    /* Fail when the top 32 bits, as a fraction of 2^32, fall under the
+     * probability, which takes no division
+     */
+    fail_state += 0x9e3779b97f4a7c15ULL;
+    uint64_t r = random_shuffle(fail_state) >> (8 * sizeof(uintptr_t) - 32);
+    return r * 100 < (uint64_t) fail_probability << 32;
+}
+
+void fail_reseed()
+{
+    __atomic_add_fetch(&fail_epoch, 1, __ATOMIC_RELAXED);
+}
+
+static void flag_error()
+{
+    __atomic_store_n(&error_occurred, true, __ATOMIC_RELAXED);
+}
+
+/* Blocks lie at least 32 bytes apart, so the address less its alignment bits
+ * already spreads them over distinct slots, and unlike a mixing hash keeps
+ * blocks allocated together in nearby slots.
+ */
+static size_t registry_home(const harness_cache_t *c, const block_element_t *b)
+{
+    return ((uintptr_t) b >> 4) & (c->registry_size - 1);
+}
+
+static void registry_put(harness_cache_t *c, block_element_t *b)
+{
+    size_t i = registry_home(c, b);
+    while (c->registry[i])
+        i = (i + 1) & (c->registry_size - 1);
+    c->registry[i] = b;
+}
+
+/* Add block b to the set of cache c, whose lock is held */
+static void registry_add(harness_cache_t *c, block_element_t *b)
+{
+    if (2 * (c->allocated_count + 1) > c->registry_size) {
+        block_element_t **old = c->registry;
+        size_t old_size = c->registry_size;
+        c->registry_size = old_size ? 2 * old_size : MIN_REGISTRY_SIZE;
+        c->registry = calloc(c->registry_size, sizeof(block_element_t *));
+        if (!c->registry)
+            report_event(MSG_FATAL, "Couldn't allocate any more memory");
+        for (size_t i = 0; i < old_size; i++) {
+            if (old[i])
+                registry_put(c, old[i]);
+        }
+        free(old);
+    }
+    registry_put(c, b);
+    c->allocated_count++;
+}
+
+/* Remove block b from the set of cache c, whose lock is held.
+ * Return false if it is not there.
+ */
+static bool registry_del(harness_cache_t *c, const block_element_t *b)
+{
+    if (!c->registry)
+        return false;
+
+    size_t mask = c->registry_size - 1;
+    size_t i = registry_home(c, b);
+    while (c->registry[i] != b) {
+        if (!c->registry[i])
+            return false;
+        i = (i + 1) & mask;
+    }
+
+    /* Shift back later members of the probe run whose home is not in
+     * (i, j], so lookups never cross an empty slot to reach them
+     */
+    for (size_t j = (i + 1) & mask; c->registry[j]; j = (j + 1) & mask) {
+        if (((j - registry_home(c, c->registry[j])) & mask) >=
+            ((j - i) & mask)) {
+            c->registry[i] = c->registry[j];
+            i = j;
+        }
+    }
+    c->registry[i] = NULL;
+    c->allocated_count--;
+    return true;
+}
+
+/* Remove block b from whichever cache holds it, for blocks whose owner
+ * cannot be trusted.  Return false if none does.
+ */
+static bool registry_del_any(const block_element_t *b)
+{
+    bool found = false;
+    pthread_mutex_lock(&caches_lock);
+    for (harness_cache_t *c = caches; c && !found; c = c->next) {
+        pthread_mutex_lock(&c->lock);
+        found = registry_del(c, b);
+        pthread_mutex_unlock(&c->lock);
+    }
+    pthread_mutex_unlock(&caches_lock);
+    return found;
+}
+
+static void cache_release(void *p)
+{
+    harness_cache_t *c = p;
+    pthread_mutex_lock(&caches_lock);
+    c->next_spare = spare_caches;
+    spare_caches = c;
+    pthread_mutex_unlock(&caches_lock);
+    local_cache = NULL;
+}
+
+static void cache_key_create()
+{
+    pthread_key_create(&cache_key, cache_release);
+}
+
+/* Return the cache of the calling thread, taking a spare one or creating it
+ * on first use
+ */
+static harness_cache_t *get_cache()
+{
+    if (local_cache)
+        return local_cache;
+
+    pthread_once(&cache_key_once, cache_key_create);
+    pthread_mutex_lock(&caches_lock);
+    harness_cache_t *c = spare_caches;
+    if (c)
+        spare_caches = c->next_spare;
+    pthread_mutex_unlock(&caches_lock);
+
+    if (!c) {
+        c = calloc(1, sizeof(harness_cache_t));
+        if (!c)
+            report_event(MSG_FATAL, "Couldn't allocate any more memory");
+        pthread_mutex_init(&c->lock, NULL);
+        pthread_mutex_lock(&caches_lock);
+        c->next = caches;
+        caches = c;
+        pthread_mutex_unlock(&caches_lock);
+    }
+    pthread_setspecific(cache_key, c);
+    local_cache = c;
+    return c;
+}
+
+/* Given pointer to block, find its footer */
+static size_t *find_footer(block_element_t *b)
+{
+    // cppcheck-suppress nullPointerRedundantCheck
+    size_t *p =
+        (size_t *) ((size_t) b + b->payload_size + sizeof(block_element_t));
+    return p;
+}
+
+/* Allocations are rounded up to this, which malloc would do anyway, so
+ * realloc knows how much slack a block has from its payload size alone
+ */
+#define BLOCK_ALIGN 16
+
+/* Bytes allocated for a checked block with size bytes of payload */
+static size_t block_bytes(size_t size)
+{
+    size_t bytes = size + sizeof(block_element_t) + sizeof(size_t) +
+                   sizeof(harness_cache_t *) + sizeof(memprof_site_t *);
+    return (bytes + BLOCK_ALIGN - 1) & ~(size_t) (BLOCK_ALIGN - 1);
+}
+
+/* Given pointer to block, find where its owning cache is recorded */
+static harness_cache_t **find_owner(block_element_t *b)
+{
+    return (harness_cache_t **) (find_footer(b) + 1);
+}
+
+/* Given pointer to block, find where its profiling site is recorded */
+static memprof_site_t **find_site(block_element_t *b)
+{
+    return (memprof_site_t **) (find_owner(b) + 1);
+}
+
+/* Return the site of caller under the current command, creating it on first
+ * use.  Return NULL for allocation failed, leaving the block unprofiled.
+ */
+static memprof_site_t *memprof_site(void *caller)
+{
+    const char *tag = memprof_current;
+    size_t h = (((uintptr_t) caller >> 2) ^ ((uintptr_t) tag >> 3)) %
+               MEMPROF_BUCKETS;
+    memprof_site_t *site = memprof_table[h];
+    while (site && (site->caller != caller || site->tag != tag))
+        site = site->next;
+    if (site)
+        return site;
+
+    site = calloc(1, sizeof(memprof_site_t));
+    if (!site)
+        return NULL;
+    site->caller = caller;
+    site->tag = tag;
+    site->next = memprof_table[h];
+    memprof_table[h] = site;
+    memprof_nsites++;
+    return site;
+}
+
+/* Return the site credited with new block b */
+static memprof_site_t *memprof_alloc(block_element_t *b, void *caller)
+{
+    pthread_mutex_lock(&memprof_lock);
+    memprof_site_t *site = memprof_site(caller);
+    if (site) {
+        site->allocs++;
+        site->bytes += b->payload_size;
+        site->live++;
+        site->live_bytes += b->payload_size;
+    }
+    pthread_mutex_unlock(&memprof_lock);
+    return site;
+}
+
+static void memprof_resize(memprof_site_t *site, size_t old, size_t size)
+{
+    pthread_mutex_lock(&memprof_lock);
+    if (size > old)
+        site->bytes += size - old;
+    site->live_bytes += size - old;
+    pthread_mutex_unlock(&memprof_lock);
+}
+
+static void memprof_free(block_element_t *b, memprof_site_t *site)
+{
+    pthread_mutex_lock(&memprof_lock);
+    site->frees++;
+    site->live--;
+    site->live_bytes -= b->payload_size;
+    pthread_mutex_unlock(&memprof_lock);
 }
 
 /* Find header of block, given its payload.
@@ -81,25 +425,28 @@ static block_element_t *find_header(void *p)
 {
     if (!p) {
         report_event(MSG_ERROR, "Attempting to free null block");
-        error_occurred = true;
+        flag_error();
     }
 
     block_element_t *b =
         (block_element_t *) ((size_t) p - sizeof(block_element_t));
-    if (cautious_mode) {
-        /* Make sure this is really an allocated block */
-        block_element_t *ab = allocated;
-        bool found = false;
-        while (ab && !found) {
-            found = ab == b;
-            ab = ab->next;
-        }
-        if (!found) {
-            report_event(MSG_ERROR,
-                         "Attempted to free unallocated block.  Address = %p",
-                         p);
-            error_occurred = true;
-        }
+
+    /* The block leaves its set here, as it is about to be freed.  Its owner
+     * is only looked up directly when both magic numbers are intact.
+     */
+    bool registered;
+    if (b->magic_header == MAGICHEADER && *find_footer(b) == MAGICFOOTER) {
+        harness_cache_t *c = *find_owner(b);
+        pthread_mutex_lock(&c->lock);
+        registered = registry_del(c, b);
+        pthread_mutex_unlock(&c->lock);
+    } else {
+        registered = registry_del_any(b);
+    }
+    if (!registered && cautious_mode) {
+        report_event(MSG_ERROR,
+                     "Attempted to free unallocated block.  Address = %p", p);
+        flag_error();
     }
 
     if (b->magic_header != MAGICHEADER) {
@@ -107,22 +454,186 @@ static block_element_t *find_header(void *p)
             MSG_ERROR,
             "Attempted to free unallocated or corrupted block.  Address = %p",
             p);
-        error_occurred = true;
+        flag_error();
     }
 
     return b;
 }
 
-/* Given pointer to block, find its footer */
-static size_t *find_footer(block_element_t *b)
+/* Blocks of at least guard_size bytes get a mapping of their own, ending in
+ * an inaccessible page right past the payload, rounded up to keep 16-byte
+ * alignment, so an overrun faults on the instruction making it.  Bytes
+ * between the end of the payload and the guard page are checked when the
+ * block is freed.  The header of such blocks keeps what others store in
+ * their trailer.
+ */
+typedef struct {
+    void *map;
+    size_t map_len;
+    harness_cache_t *owner;
+    memprof_site_t *site;
+    block_element_t block; /* Must come last, right before the payload */
+} guard_header_t;
+
+#define GUARD_ALIGN 16
+
+int guard_size = 0;
+
+/* Freed blocks are held back from reuse, filled with FILLCHAR or, for those
+ * with guard pages, made inaccessible, until more than quarantine_limit of
+ * them are waiting.  The oldest is then checked for writes after it was
+ * freed and released.
+ */
+typedef struct __quarantined {
+    block_element_t *block; /* NULL for a block with a guard page */
+    void *map;
+    size_t map_len;
+    struct __quarantined *next;
+} quarantined_t;
+
+int quarantine_limit = 0;
+
+static quarantined_t *quarantine_head = NULL, *quarantine_tail = NULL;
+static size_t quarantine_count = 0;
+static pthread_mutex_t quarantine_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void quarantine_release(quarantined_t *q)
 {
-    // cppcheck-suppress nullPointerRedundantCheck
-    size_t *p =
-        (size_t *) ((size_t) b + b->payload_size + sizeof(block_element_t));
+    if (!q->block) {
+        munmap(q->map, q->map_len);
+        return;
+    }
+
+    unsigned char *p = q->block->payload;
+    for (size_t i = 0; i < q->block->payload_size; i++) {
+        if (p[i] != FILLCHAR) {
+            report_event(MSG_ERROR,
+                         "Block with address %p was written to after being "
+                         "freed",
+                         p);
+            flag_error();
+            break;
+        }
+    }
+    free(q->block);
+}
+
+/* Hold back freed block b, or the mapping of a block with a guard page */
+static void quarantine_add(block_element_t *b, void *map, size_t map_len)
+{
+    quarantined_t *q = malloc(sizeof(quarantined_t));
+    if (!q) {
+        /* Quarantine is best effort, release the block right away */
+        if (b)
+            free(b);
+        else
+            munmap(map, map_len);
+        return;
+    }
+    q->block = b;
+    q->map = map;
+    q->map_len = map_len;
+    q->next = NULL;
+
+    pthread_mutex_lock(&quarantine_lock);
+    if (quarantine_tail)
+        quarantine_tail->next = q;
+    else
+        quarantine_head = q;
+    quarantine_tail = q;
+    quarantine_count++;
+
+    while (quarantine_count > (size_t) quarantine_limit) {
+        quarantined_t *old = quarantine_head;
+        quarantine_head = old->next;
+        if (!quarantine_head)
+            quarantine_tail = NULL;
+        quarantine_count--;
+        quarantine_release(old);
+        free(old);
+    }
+    pthread_mutex_unlock(&quarantine_lock);
+}
+
+static void *guard_alloc(alloc_t alloc_type, size_t size, void *caller)
+{
+    static size_t page = 0;
+    if (!page)
+        page = sysconf(_SC_PAGESIZE);
+
+    size_t room = (size + GUARD_ALIGN - 1) & ~(size_t) (GUARD_ALIGN - 1);
+    size_t data_len = (sizeof(guard_header_t) + room + page - 1) & ~(page - 1);
+    char *map = mmap(NULL, data_len + page, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED || mprotect(map + data_len, page, PROT_NONE)) {
+        report_event(MSG_FATAL, "Couldn't map any more memory");
+        return NULL;
+    }
+
+    unsigned char *p = (unsigned char *) map + data_len - room;
+    guard_header_t *g = (guard_header_t *) (p - sizeof(guard_header_t));
+    g->map = map;
+    g->map_len = data_len + page;
+    g->block.payload_size = size;
+    g->block.magic_header = MAGICGUARD;
+    /* Fresh mappings are zeroed, as calloc needs */
+    if (fill_mode && alloc_type != TEST_CALLOC)
+        memset(p, FILLCHAR, size);
+    memset(p + size, FILLCHAR, room - size);
+
+    harness_cache_t *c = get_cache();
+    g->owner = c;
+    pthread_mutex_lock(&c->lock);
+    registry_add(c, &g->block);
+    pthread_mutex_unlock(&c->lock);
+
+    g->site = NULL;
+    if (memprof_mode)
+        g->site = memprof_alloc(&g->block, caller);
     return p;
 }
 
-static void *alloc(alloc_t alloc_type, size_t size)
+static void guard_free(block_element_t *b)
+{
+    guard_header_t *g =
+        (guard_header_t *) ((char *) b - offsetof(guard_header_t, block));
+
+    pthread_mutex_lock(&g->owner->lock);
+    bool registered = registry_del(g->owner, b);
+    pthread_mutex_unlock(&g->owner->lock);
+    if (!registered && cautious_mode) {
+        report_event(MSG_ERROR,
+                     "Attempted to free unallocated block.  Address = %p",
+                     b->payload);
+        flag_error();
+    }
+
+    size_t room =
+        (b->payload_size + GUARD_ALIGN - 1) & ~(size_t) (GUARD_ALIGN - 1);
+    for (size_t i = b->payload_size; i < room; i++) {
+        if (b->payload[i] != FILLCHAR) {
+            report_event(MSG_ERROR,
+                         "Corruption detected in block with address %p when "
+                         "attempting to free it",
+                         b->payload);
+            flag_error();
+            break;
+        }
+    }
+    if (g->site)
+        memprof_free(b, g->site);
+
+    /* Any later access to the block faults */
+    void *map = g->map;
+    size_t map_len = g->map_len;
+    mprotect(map, map_len, PROT_NONE);
+    if (quarantine_limit || quarantine_count)
+        quarantine_add(NULL, map, map_len);
+    else
+        munmap(map, map_len);
+}
+
+static void *alloc(alloc_t alloc_type, size_t size, void *caller)
 {
     if (noallocate_mode) {
         char *msg_alloc_forbidden[] = {
@@ -133,7 +644,8 @@ static void *alloc(alloc_t alloc_type, size_t size)
         return NULL;
     }
 
-    if (fail_allocation()) {
+    /* Failure injection is rarely enabled, so keep its check off the path */
+    if (__builtin_expect(fail_probability, 0) && fail_allocation()) {
         char *msg_alloc_failure[] = {
             "Malloc returning NULL",
             "Calloc returning NULL",
@@ -142,11 +654,27 @@ static void *alloc(alloc_t alloc_type, size_t size)
         return NULL;
     }
 
-    block_element_t *new_block =
-        malloc(size + sizeof(block_element_t) + sizeof(size_t));
+    mem_count_alloc(size);
+
+    if (__builtin_expect(guard_size, 0) && size >= (size_t) guard_size)
+        return guard_alloc(alloc_type, size, caller);
+
+    if (lite_mode) {
+        block_element_t *b = malloc(size + sizeof(block_element_t));
+        if (!b)
+            report_event(MSG_FATAL, "Couldn't allocate any more memory");
+        b->payload_size = size;
+        b->magic_header = MAGICLITE;
+        if (alloc_type == TEST_CALLOC)
+            memset(&b->payload, 0, size);
+        __atomic_fetch_add(&lite_count, 1, __ATOMIC_RELAXED);
+        return &b->payload;
+    }
+
+    block_element_t *new_block = malloc(block_bytes(size));
     if (!new_block) {
         report_event(MSG_FATAL, "Couldn't allocate any more memory");
-        error_occurred = true;
+        flag_error();
     }
 
     // cppcheck-suppress nullPointerRedundantCheck
@@ -155,16 +683,18 @@ static void *alloc(alloc_t alloc_type, size_t size)
     new_block->payload_size = size;
     *find_footer(new_block) = MAGICFOOTER;
     void *p = (void *) &new_block->payload;
-    memset(p, !alloc_type * FILLCHAR, size);
-    // cppcheck-suppress nullPointerRedundantCheck
-    new_block->next = allocated;
-    // cppcheck-suppress nullPointerRedundantCheck
-    new_block->prev = NULL;
+    if (fill_mode || alloc_type == TEST_CALLOC)
+        memset(p, !alloc_type * FILLCHAR, size);
+
+    harness_cache_t *c = get_cache();
+    *find_owner(new_block) = c;
+    pthread_mutex_lock(&c->lock);
+    registry_add(c, new_block);
+    pthread_mutex_unlock(&c->lock);
 
-    if (allocated)
-        allocated->prev = new_block;
-    allocated = new_block;
-    allocated_count++;
+    *find_site(new_block) = NULL;
+    if (__builtin_expect(memprof_mode, 0))
+        *find_site(new_block) = memprof_alloc(new_block, caller);
 
     return p;
 }
@@ -173,7 +703,7 @@ static void *alloc(alloc_t alloc_type, size_t size)
 
 void *test_malloc(size_t size)
 {
-    return alloc(TEST_MALLOC, size);
+    return alloc(TEST_MALLOC, size, __builtin_return_address(0));
 }
 
 // cppcheck-suppress unusedFunction
@@ -184,7 +714,7 @@ void *test_calloc(size_t nelem, size_t elsize)
      */
     if (!nelem || !elsize || nelem > SIZE_MAX / elsize)
         return NULL;
-    return alloc(TEST_CALLOC, nelem * elsize);
+    return alloc(TEST_CALLOC, nelem * elsize, __builtin_return_address(0));
 }
 
 void test_free(void *p)
@@ -197,38 +727,153 @@ void test_free(void *p)
     if (!p)
         return;
 
-    block_element_t *b = find_header(p);
+    /* Blocks of lite mode carry no more than their header to check */
+    block_element_t *b =
+        (block_element_t *) ((size_t) p - sizeof(block_element_t));
+    if (b->magic_header == MAGICLITE) {
+        mem_count_free(b->payload_size);
+        b->magic_header = MAGICFREE;
+        __atomic_fetch_sub(&lite_count, 1, __ATOMIC_RELAXED);
+        free(b);
+        return;
+    }
+    if (b->magic_header == MAGICGUARD) {
+        mem_count_free(b->payload_size);
+        guard_free(b);
+        return;
+    }
+
+    b = find_header(p);
     size_t footer = *find_footer(b);
     if (footer != MAGICFOOTER) {
         report_event(MSG_ERROR,
                      "Corruption detected in block with address %p when "
                      "attempting to free it",
                      p);
-        error_occurred = true;
+        flag_error();
     }
+    mem_count_free(b->payload_size);
+    if (footer == MAGICFOOTER && *find_site(b))
+        memprof_free(b, *find_site(b));
     b->magic_header = MAGICFREE;
     *find_footer(b) = MAGICFREE;
-    memset(p, FILLCHAR, b->payload_size);
-
-    /* Unlink from list */
-    block_element_t *bn = b->next;
-    block_element_t *bp = b->prev;
-    if (bp)
-        bp->next = bn;
+    /* Blocks still queued after the limit drops to 0 go on being added,
+     * so that the oldest get released, and must be filled like the rest.
+     */
+    bool quarantine = quarantine_limit || quarantine_count;
+    if (fill_mode || quarantine)
+        memset(p, FILLCHAR, b->payload_size);
+    if (__builtin_expect(quarantine, 0))
+        quarantine_add(b, NULL, 0);
     else
-        allocated = bn;
-    if (bn)
-        bn->prev = bp;
+        free(b);
+}
 
-    free(b);
-    allocated_count--;
+/* Move the payload of p to a new block of size bytes, freeing p */
+static void *move_block(void *p, size_t old, size_t size, void *caller)
+{
+    void *q = alloc(TEST_MALLOC, size, caller);
+    if (!q)
+        return NULL;
+    memcpy(q, p, old < size ? old : size);
+    test_free(p);
+    return q;
+}
+
+// cppcheck-suppress unusedFunction
+void *test_realloc(void *p, size_t size)
+{
+    void *caller = __builtin_return_address(0);
+    if (!p)
+        return alloc(TEST_MALLOC, size, caller);
+    if (!size) {
+        test_free(p);
+        return NULL;
+    }
+
+    if (noallocate_mode) {
+        report_event(MSG_FATAL, "Calls to realloc are disallowed");
+        return NULL;
+    }
+
+    if (__builtin_expect(fail_probability, 0) && fail_allocation()) {
+        report_event(MSG_WARN, "Realloc returning NULL");
+        return NULL;
+    }
+
+    block_element_t *b =
+        (block_element_t *) ((size_t) p - sizeof(block_element_t));
+    if (b->magic_header == MAGICLITE) {
+        mem_count_free(b->payload_size);
+        mem_count_alloc(size);
+        b = realloc(b, size + sizeof(block_element_t));
+        if (!b)
+            report_event(MSG_FATAL, "Couldn't allocate any more memory");
+        b->payload_size = size;
+        return &b->payload;
+    }
+    if (b->magic_header == MAGICGUARD)
+        return move_block(p, b->payload_size, size, caller);
+    if (b->magic_header != MAGICHEADER || *find_footer(b) != MAGICFOOTER) {
+        report_event(MSG_ERROR,
+                     "Attempted to realloc unallocated or corrupted block.  "
+                     "Address = %p",
+                     p);
+        flag_error();
+        return NULL;
+    }
+    /* Blocks growing past the guard size get their guard page */
+    if (__builtin_expect(guard_size, 0) && size >= (size_t) guard_size)
+        return move_block(p, b->payload_size, size, caller);
+
+    size_t old = b->payload_size;
+    harness_cache_t *owner = *find_owner(b);
+    memprof_site_t *site = *find_site(b);
+
+    /* Resizing within the slack left by rounding the block up only needs
+     * the trailer moved.  Otherwise, the block leaves the set while realloc
+     * may move it, and joins the one of this thread.
+     */
+    if (block_bytes(size) > block_bytes(old)) {
+        pthread_mutex_lock(&owner->lock);
+        bool registered = registry_del(owner, b);
+        pthread_mutex_unlock(&owner->lock);
+        if (!registered && cautious_mode) {
+            report_event(MSG_ERROR,
+                         "Attempted to realloc unallocated block.  Address = "
+                         "%p",
+                         p);
+            flag_error();
+        }
+
+        block_element_t *new_block = realloc(b, block_bytes(size));
+        if (!new_block)
+            report_event(MSG_FATAL, "Couldn't allocate any more memory");
+        b = new_block;
+        owner = get_cache();
+        pthread_mutex_lock(&owner->lock);
+        registry_add(owner, b);
+        pthread_mutex_unlock(&owner->lock);
+    }
+
+    b->payload_size = size;
+    *find_footer(b) = MAGICFOOTER;
+    *find_owner(b) = owner;
+    *find_site(b) = site;
+    if (fill_mode && size > old)
+        memset(b->payload + old, FILLCHAR, size - old);
+    mem_count_free(old);
+    mem_count_alloc(size);
+    if (site)
+        memprof_resize(site, old, size);
+    return &b->payload;
 }
 
 // cppcheck-suppress unusedFunction
 char *test_strdup(const char *s)
 {
     size_t len = strlen(s) + 1;
-    void *new = test_malloc(len);
+    void *new = alloc(TEST_MALLOC, len, __builtin_return_address(0));
     if (!new)
         return NULL;
 
@@ -237,11 +882,116 @@ char *test_strdup(const char *s)
 
 size_t allocation_check()
 {
-    return allocated_count;
+    size_t count = __atomic_load_n(&lite_count, __ATOMIC_RELAXED);
+    pthread_mutex_lock(&caches_lock);
+    for (harness_cache_t *c = caches; c; c = c->next) {
+        pthread_mutex_lock(&c->lock);
+        count += c->allocated_count;
+        pthread_mutex_unlock(&c->lock);
+    }
+    pthread_mutex_unlock(&caches_lock);
+    return count;
 }
 
 /* Implementation of functions for testing */
 
+void memprof_tag(const char *tag)
+{
+    memprof_current = tag;
+}
+
+/* Name of code address addr, as function+offset when its symbol is exported,
+ * else as file+offset, which addr2line can resolve
+ */
+static void memprof_name(void *addr, char *buf, size_t len)
+{
+    Dl_info info;
+    if (!dladdr(addr, &info))
+        snprintf(buf, len, "%p", addr);
+    else if (info.dli_sname)
+        snprintf(buf, len, "%s+0x%lx", info.dli_sname,
+                 (unsigned long) ((char *) addr - (char *) info.dli_saddr));
+    else
+        snprintf(buf, len, "%s+0x%lx", info.dli_fname,
+                 (unsigned long) ((char *) addr - (char *) info.dli_fbase));
+}
+
+static int memprof_cmp_bytes(const void *a, const void *b)
+{
+    const memprof_site_t *sa = *(memprof_site_t *const *) a;
+    const memprof_site_t *sb = *(memprof_site_t *const *) b;
+    return (sa->bytes < sb->bytes) - (sa->bytes > sb->bytes);
+}
+
+/* Print the totals of sites sharing a key, given sites sorted by bytes.
+ * Sites sharing a key are merged into the first of them in the order.
+ */
+static void memprof_print(memprof_site_t **sites, size_t n, bool by_tag)
+{
+    report(1, "%12s %10s %10s %10s %12s  %s", "bytes", "allocs", "frees",
+           "live", "live bytes", by_tag ? "command" : "call site");
+    for (size_t i = 0; i < n; i++) {
+        memprof_site_t sum = *sites[i];
+        bool seen = false;
+        for (size_t j = 0; j < i && !seen; j++)
+            seen = by_tag ? sites[j]->tag == sum.tag
+                          : sites[j]->caller == sum.caller;
+        if (seen)
+            continue;
+        for (size_t j = i + 1; j < n; j++) {
+            if (by_tag ? sites[j]->tag != sum.tag
+                       : sites[j]->caller != sum.caller)
+                continue;
+            sum.allocs += sites[j]->allocs;
+            sum.frees += sites[j]->frees;
+            sum.bytes += sites[j]->bytes;
+            sum.live += sites[j]->live;
+            sum.live_bytes += sites[j]->live_bytes;
+        }
+
+        char name[128];
+        if (by_tag)
+            snprintf(name, sizeof(name), "%s", sum.tag ? sum.tag : "(none)");
+        else
+            memprof_name(sum.caller, name, sizeof(name));
+        report(1, "%12lu %10lu %10lu %10lu %12lu  %s", sum.bytes, sum.allocs,
+               sum.frees, sum.live, sum.live_bytes, name);
+    }
+}
+
+void memprof_report()
+{
+    pthread_mutex_lock(&memprof_lock);
+    memprof_site_t **sites = malloc(memprof_nsites * sizeof(memprof_site_t *));
+    if (!sites) {
+        pthread_mutex_unlock(&memprof_lock);
+        report_event(MSG_WARN, "Couldn't allocate memory for the profile");
+        return;
+    }
+    size_t n = 0;
+    for (size_t h = 0; h < MEMPROF_BUCKETS; h++) {
+        for (memprof_site_t *site = memprof_table[h]; site; site = site->next)
+            sites[n++] = site;
+    }
+    qsort(sites, n, sizeof(memprof_site_t *), memprof_cmp_bytes);
+
+    memprof_print(sites, n, false);
+    report(1, "");
+    memprof_print(sites, n, true);
+    pthread_mutex_unlock(&memprof_lock);
+    free(sites);
+}
+
+void memprof_reset()
+{
+    pthread_mutex_lock(&memprof_lock);
+    for (size_t h = 0; h < MEMPROF_BUCKETS; h++) {
+        for (memprof_site_t *site = memprof_table[h]; site; site = site->next)
+            site->allocs = site->frees = site->bytes = 0;
+    }
+    pthread_mutex_unlock(&memprof_lock);
+}
+
 /* Set/unset cautious mode.
  * In this mode, makes extra sure any block to be freed is currently allocated.
  */
@@ -261,9 +1011,81 @@ void set_noallocate_mode(bool noallocate)
 /* Return whether any errors have occurred since last time set error limit */
 bool error_check()
 {
-    bool e = error_occurred;
-    error_occurred = false;
-    return e;
+    return __atomic_exchange_n(&error_occurred, false, __ATOMIC_RELAXED);
+}
+
+static int64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* POSIX timers are only relied upon on Linux */
+static bool arm_timer()
+{
+#ifdef __linux__
+    struct sigevent sev = {
+        .sigev_notify = SIGEV_SIGNAL,
+        .sigev_signo = SIGALRM,
+    };
+    struct itimerspec its = {
+        .it_interval = {.tv_nsec = TIMER_TICK_MS * 1000000},
+        .it_value = {.tv_nsec = TIMER_TICK_MS * 1000000},
+    };
+    if (timer_create(CLOCK_MONOTONIC, &sev, &script_timer))
+        return false;
+    if (timer_settime(script_timer, 0, &its, NULL)) {
+        timer_delete(script_timer);
+        return false;
+    }
+    sigprocmask(SIG_BLOCK, NULL, &timer_mask);
+    timer_armed = true;
+    return true;
+#else
+    return false;
+#endif
+}
+
+void exception_timer_stop()
+{
+    if (!timer_armed)
+        return;
+#ifdef __linux__
+    timer_delete(script_timer);
+#endif
+    timer_armed = false;
+}
+
+bool exception_time_up()
+{
+    /* A tick may still be pending once the timer is deleted */
+    if (!timer_armed)
+        return time_limited;
+    return time_limited && now_ns() >= deadline_ns;
+}
+
+static void cancel_time_limit()
+{
+    if (!time_limited)
+        return;
+    if (!timer_armed)
+        alarm(0);
+    time_limited = false;
+}
+
+/* Finish an error return of exception_setup */
+static bool exception_return()
+{
+    if (!mask_saved)
+        sigprocmask(SIG_SETMASK, &timer_mask, NULL);
+    jmp_ready = false;
+    cancel_time_limit();
+
+    if (error_message)
+        report_event(MSG_ERROR, error_message);
+    error_message = "";
+    return false;
 }
 
 /* Prepare for a risky operation using setjmp.
@@ -271,24 +1093,27 @@ bool error_check()
  */
 bool exception_setup(bool limit_time)
 {
-    if (sigsetjmp(env, 1)) {
-        /* Got here from longjmp */
-        jmp_ready = false;
-        if (time_limited) {
-            alarm(0);
-            time_limited = false;
-        }
+    if (timer_mode && !timer_armed && !arm_timer()) {
+        report_event(MSG_WARN, "Couldn't create timer, using alarm");
+        timer_mode = 0;
+    }
 
-        if (error_message)
-            report_event(MSG_ERROR, error_message);
-        error_message = "";
-        return false;
+    /* Got here from longjmp when sigsetjmp returns non-zero */
+    mask_saved = !timer_armed;
+    if (mask_saved) {
+        if (sigsetjmp(env, 1))
+            return exception_return();
+    } else if (sigsetjmp(env, 0)) {
+        return exception_return();
     }
 
     /* Got here from initial call */
     jmp_ready = true;
     if (limit_time) {
-        alarm(time_limit);
+        if (timer_armed)
+            deadline_ns = now_ns() + (int64_t) time_limit * 1000000000;
+        else
+            alarm(time_limit);
         time_limited = true;
     }
     return true;
@@ -297,10 +1122,7 @@ bool exception_setup(bool limit_time)
 /* Call once past risky code */
 void exception_cancel()
 {
-    if (time_limited) {
-        alarm(0);
-        time_limited = false;
-    }
+    cancel_time_limit();
 
     jmp_ready = false;
     error_message = "";
@@ -309,7 +1131,7 @@ void exception_cancel()
 /* Use longjmp to return to most recent exception setup */
 void trigger_exception(char *msg)
 {
-    error_occurred = true;
+    flag_error();
     error_message = msg;
     if (jmp_ready)
         siglongjmp(env, 1);
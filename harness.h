@@ -14,16 +14,68 @@ void *test_malloc(size_t size);
 void *test_calloc(size_t nmemb, size_t size);
 void test_free(void *p);
 char *test_strdup(const char *s);
-/* FIXME: provide test_realloc as well */
+
+/* Resize the block at p, growing or shrinking it in place when the memory
+ * after it allows, and keeping it checked like any other block
+ */
+void *test_realloc(void *p, size_t size);
 
 #ifdef INTERNAL
 
-/* Report number of allocated blocks */
+/* Report number of allocated blocks, summed over the caches of all threads */
 size_t allocation_check();
 
 /* Probability of malloc failing, expressed as percent */
 extern int fail_probability;
 
+/* Seed of the malloc failures of each thread, 0 for a different sequence on
+ * every run.  Takes effect on the next call to fail_reseed().
+ */
+extern int fail_seed;
+
+/* Restart the sequences of malloc failures from fail_seed */
+void fail_reseed();
+
+/* Time limit of risky operations, expressed in seconds */
+extern int time_limit;
+
+/* When non-zero, new blocks are only counted: no footer, fill pattern or
+ * registration, so freeing them cannot be validated.  Blocks allocated
+ * before switching modes keep being checked when freed.
+ */
+extern int lite_mode;
+
+/* When non-zero, fill blocks with a pattern as they are allocated and freed,
+ * exposing reads of uninitialized or freed memory
+ */
+extern int fill_mode;
+
+/* Blocks of at least this many bytes are placed right before an inaccessible
+ * page, so overruns fault where they happen.  Zero disables guard pages.
+ * Each such block takes two memory mappings, and the kernel limits their
+ * number (vm.max_map_count), so guard only large blocks of big queues.
+ */
+extern int guard_size;
+
+/* Number of freed blocks held back from reuse, so that writes to them are
+ * detected.  Freed blocks with guard pages become inaccessible.
+ */
+extern int quarantine_limit;
+
+/* When non-zero, record the call site of each new block and the command
+ * running when it was allocated.  Blocks of lite mode are not profiled.
+ */
+extern int memprof_mode;
+
+/* Credit allocations to command tag from now on, NULL for none */
+void memprof_tag(const char *tag);
+
+/* Print bytes, blocks allocated, freed and live per call site and command */
+void memprof_report();
+
+/* Clear the totals of the profile, keeping track of live blocks */
+void memprof_reset();
+
 /*
  * Set/unset cautious mode.
  * In this mode, makes extra sure any block to be freed is currently allocated.
@@ -44,6 +96,21 @@ bool error_check();
  */
 bool exception_setup(bool limit_time);
 
+/* When non-zero, time risky operations with one interval timer armed on the
+ * first of them, rather than with alarm() around each, and skip saving the
+ * signal mask when setting up.  Where the timer cannot be created, as off
+ * Linux, the mode is turned back off with a warning.
+ */
+extern int timer_mode;
+
+/* Delete the timer of timer mode.  The next risky operation arms it again
+ * while the mode is on.
+ */
+void exception_timer_stop();
+
+/* Return whether SIGALRM means the running operation is out of time */
+bool exception_time_up();
+
 /* Call once past risky code */
 void exception_cancel();
 
@@ -57,6 +124,7 @@ void trigger_exception(char *msg);
 #define malloc test_malloc
 #define calloc test_calloc
 #define free test_free
+#define realloc test_realloc
 
 /* Use undef to avoid strdup redefined error */
 #undef strdup
@@ -0,0 +1,100 @@
+/* Log-linear histogram */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "hist.h"
+
+#define SUB_BUCKETS (1 << HIST_SUB_BITS)
+
+/* The values of highest bit b above HIST_SUB_BITS are shifted right by
+ * b - HIST_SUB_BITS to land among SUB_BUCKETS buckets, past those of all
+ * smaller values
+ */
+#define N_BUCKETS ((64 - HIST_SUB_BITS + 1) * SUB_BUCKETS)
+
+struct __hist {
+    uint64_t count;
+    uint64_t max;
+    double sum;
+    uint64_t buckets[N_BUCKETS];
+};
+
+static unsigned bucket_of(uint64_t v)
+{
+    int msb = v ? 63 - __builtin_clzll(v) : 0;
+    int shift = msb > HIST_SUB_BITS ? msb - HIST_SUB_BITS : 0;
+    return shift * SUB_BUCKETS + (v >> shift);
+}
+
+/* Largest value counted in bucket i */
+static uint64_t bucket_top(unsigned i)
+{
+    if (i < 2 * SUB_BUCKETS)
+        return i;
+    unsigned shift = i / SUB_BUCKETS - 1;
+    uint64_t low = (uint64_t) (i - shift * SUB_BUCKETS) << shift;
+    return low + ((1ULL << shift) - 1);
+}
+
+hist_t *hist_new()
+{
+    return calloc(1, sizeof(hist_t));
+}
+
+void hist_record(hist_t *h, uint64_t v)
+{
+    h->buckets[bucket_of(v)]++;
+    h->count++;
+    h->sum += v;
+    if (v > h->max)
+        h->max = v;
+}
+
+uint64_t hist_count(const hist_t *h)
+{
+    return h->count;
+}
+
+double hist_mean(const hist_t *h)
+{
+    return h->count ? h->sum / h->count : 0;
+}
+
+uint64_t hist_max(const hist_t *h)
+{
+    return h->max;
+}
+
+uint64_t hist_quantile(const hist_t *h, double q)
+{
+    if (!h->count)
+        return 0;
+
+    /* Rank of the value sought, counting from 1 */
+    uint64_t rank = (uint64_t) (q * h->count);
+    if (rank < q * h->count)
+        rank++;
+    if (!rank)
+        rank = 1;
+
+    uint64_t seen = 0;
+    for (unsigned i = 0; i < N_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen >= rank) {
+            uint64_t top = bucket_top(i);
+            return top < h->max ? top : h->max;
+        }
+    }
+    return h->max;
+}
+
+void hist_reset(hist_t *h)
+{
+    memset(h, 0, sizeof(hist_t));
+}
+
+void hist_free(hist_t *h)
+{
+    free(h);
+}
@@ -0,0 +1,41 @@
+#ifndef LAB0_HIST_H
+#define LAB0_HIST_H
+
+/* Log-linear histogram of non-negative values, such as latencies.
+ *
+ * Values below 2^(HIST_SUB_BITS + 1) each have a bucket of their own.  Above
+ * that, every power of two is split into 2^HIST_SUB_BITS buckets of equal
+ * width, so any recorded value is known to within 1/2^HIST_SUB_BITS of
+ * itself, over the whole 64-bit range, in a fixed number of counters.
+ */
+
+#include <stdint.h>
+
+#define HIST_SUB_BITS 5
+
+typedef struct __hist hist_t;
+
+/* Return an empty histogram, NULL for allocation failed */
+hist_t *hist_new();
+
+/* Count one occurrence of value v */
+void hist_record(hist_t *h, uint64_t v);
+
+/* Number of values recorded */
+uint64_t hist_count(const hist_t *h);
+
+/* Mean and largest of the values recorded, 0 when empty */
+double hist_mean(const hist_t *h);
+uint64_t hist_max(const hist_t *h);
+
+/* Value below or at which fraction q of the recorded values lie, as the
+ * upper end of its bucket, 0 when empty
+ */
+uint64_t hist_quantile(const hist_t *h, double q);
+
+/* Forget all values recorded */
+void hist_reset(hist_t *h);
+
+void hist_free(hist_t *h);
+
+#endif /* LAB0_HIST_H */
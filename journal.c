@@ -0,0 +1,293 @@
+/* Append-only journal of queue mutations */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "journal.h"
+#include "report.h"
+
+#define JOURNAL_MAGIC "LAB0JNL"
+#define JOURNAL_MAGIC_LEN 8
+
+/* Size of the buffer collecting records between writes */
+#define JOURNAL_BUFSIZE 65536
+
+/* Longest encoding of the fixed part of a record: one operation byte, three
+ * 64-bit varints and the checksum
+ */
+#define RECORD_OVERHEAD (1 + 3 * 10 + 4)
+
+int journal_batch = 1;
+int journal_usec = 1000;
+
+static int journal_fd = -1;
+static char journal_buf[JOURNAL_BUFSIZE];
+static size_t buf_len = 0;
+
+/* Records appended but not yet made durable */
+static size_t pending = 0;
+static int64_t first_pending_usec = 0;
+
+static int64_t now_usec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* FNV-1a hash of the record bytes */
+static uint32_t checksum(const unsigned char *p, size_t len)
+{
+    uint32_t h = 0x811c9dc5;
+    while (len--) {
+        h ^= *p++;
+        h *= 0x01000193;
+    }
+    return h;
+}
+
+static size_t put_varint(unsigned char *p, uint64_t v)
+{
+    size_t n = 0;
+    while (v >= 0x80) {
+        p[n++] = (v & 0x7f) | 0x80;
+        v >>= 7;
+    }
+    p[n++] = v;
+    return n;
+}
+
+/* Decode a varint from [*pp, end), return false if it is truncated */
+static bool get_varint(const unsigned char **pp,
+                       const unsigned char *end,
+                       uint64_t *v)
+{
+    const unsigned char *p = *pp;
+    *v = 0;
+    for (int shift = 0; p < end && shift < 64; shift += 7) {
+        unsigned char c = *p++;
+        *v |= (uint64_t) (c & 0x7f) << shift;
+        if (!(c & 0x80)) {
+            *pp = p;
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool write_all(const char *p, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = write(journal_fd, p, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return false;
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+static bool flush_buf()
+{
+    bool ok = write_all(journal_buf, buf_len);
+    buf_len = 0;
+    return ok;
+}
+
+bool journal_sync()
+{
+    if (journal_fd < 0)
+        return true;
+
+    bool ok = flush_buf();
+    if (pending)
+        ok = !fsync(journal_fd) && ok;
+    pending = 0;
+    return ok;
+}
+
+bool journal_append(const journal_rec_t *rec)
+{
+    if (journal_fd < 0)
+        return false;
+
+    unsigned char head[RECORD_OVERHEAD];
+    size_t n = 0;
+    head[n++] = rec->op;
+    n += put_varint(head + n, rec->qid);
+    n += put_varint(head + n, rec->arg);
+    n += put_varint(head + n, rec->len);
+
+    /* Checksum covers the fixed part and the string */
+    uint32_t h = checksum(head, n);
+    for (size_t i = 0; i < rec->len; i++) {
+        h ^= (unsigned char) rec->str[i];
+        h *= 0x01000193;
+    }
+
+    bool ok = true;
+    if (buf_len + n + rec->len + sizeof(h) > JOURNAL_BUFSIZE)
+        ok = flush_buf();
+    if (n + rec->len + sizeof(h) > JOURNAL_BUFSIZE) {
+        /* Too big to be buffered */
+        ok = ok && write_all((char *) head, n) &&
+             write_all(rec->str, rec->len) &&
+             write_all((char *) &h, sizeof(h));
+    } else {
+        memcpy(journal_buf + buf_len, head, n);
+        buf_len += n;
+        memcpy(journal_buf + buf_len, rec->str, rec->len);
+        buf_len += rec->len;
+        memcpy(journal_buf + buf_len, &h, sizeof(h));
+        buf_len += sizeof(h);
+    }
+
+    if (!pending++ && journal_batch > 1)
+        first_pending_usec = now_usec();
+    if (pending >= (size_t) journal_batch ||
+        (journal_usec > 0 &&
+         now_usec() - first_pending_usec >= journal_usec))
+        ok = journal_sync() && ok;
+    return ok;
+}
+
+/* Replay the records in [p, end) through apply.
+ * Return the offset following the last valid record, or -1 if apply failed.
+ */
+static ssize_t replay(const unsigned char *base,
+                      size_t len,
+                      journal_apply_t apply,
+                      size_t *replayed)
+{
+    const unsigned char *p = base + JOURNAL_MAGIC_LEN, *end = base + len;
+    char *str = NULL;
+    size_t str_size = 0;
+    ssize_t valid = JOURNAL_MAGIC_LEN;
+
+    while (p < end) {
+        const unsigned char *rec_start = p;
+        journal_rec_t rec;
+        uint64_t qid, slen;
+        uint32_t h;
+
+        rec.op = *p++;
+        if (rec.op >= N_JOURNAL_OP || !get_varint(&p, end, &qid) ||
+            !get_varint(&p, end, &rec.arg) || !get_varint(&p, end, &slen) ||
+            (size_t) (end - p) < sizeof(h) ||
+            slen > (size_t) (end - p) - sizeof(h))
+            break;
+
+        memcpy(&h, p + slen, sizeof(h));
+        if (h != checksum(rec_start, p + slen - rec_start))
+            break;
+
+        if (slen + 1 > str_size) {
+            if (str)
+                free_block(str, str_size);
+            str_size = slen + 1;
+            str = malloc_or_fail(str_size, "replay");
+        }
+        memcpy(str, p, slen);
+        str[slen] = '\0';
+        rec.qid = qid;
+        rec.str = str;
+        rec.len = slen;
+        if (!apply(&rec)) {
+            valid = -1;
+            break;
+        }
+
+        p += slen + sizeof(h);
+        valid = p - base;
+        (*replayed)++;
+    }
+
+    if (str)
+        free_block(str, str_size);
+    return valid;
+}
+
+bool journal_open(const char *path, journal_apply_t apply, size_t *replayed)
+{
+    *replayed = 0;
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st)) {
+        close(fd);
+        return false;
+    }
+
+    size_t len = st.st_size;
+    ssize_t valid = 0;
+    if (len >= JOURNAL_MAGIC_LEN) {
+        unsigned char *base = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (base == MAP_FAILED) {
+            close(fd);
+            return false;
+        }
+        if (!memcmp(base, JOURNAL_MAGIC, JOURNAL_MAGIC_LEN))
+            valid = replay(base, len, apply, replayed);
+        else
+            valid = -1;
+        munmap(base, len);
+    } else if (len > 0) {
+        /* Crashed while writing the magic number */
+        len = 0;
+    }
+
+    if (valid < 0) {
+        close(fd);
+        return false;
+    }
+
+    /* Drop a torn tail, so new records follow the last valid one */
+    if ((size_t) valid < len) {
+        report(1, "Journal '%s': discarding %lu bytes of incomplete records",
+               path, len - valid);
+        if (ftruncate(fd, valid)) {
+            close(fd);
+            return false;
+        }
+    }
+
+    journal_fd = fd;
+    buf_len = 0;
+    pending = 0;
+    if (!valid) {
+        memcpy(journal_buf, JOURNAL_MAGIC, JOURNAL_MAGIC_LEN);
+        buf_len = JOURNAL_MAGIC_LEN;
+        pending = 1;
+    }
+
+    if (lseek(fd, valid, SEEK_SET) < 0 || !journal_sync()) {
+        close(fd);
+        journal_fd = -1;
+        return false;
+    }
+    return true;
+}
+
+bool journal_is_open()
+{
+    return journal_fd >= 0;
+}
+
+void journal_close()
+{
+    if (journal_fd < 0)
+        return;
+
+    journal_sync();
+    close(journal_fd);
+    journal_fd = -1;
+}
@@ -0,0 +1,90 @@
+#ifndef LAB0_JOURNAL_H
+#define LAB0_JOURNAL_H
+
+/* Append-only redo journal of queue mutations.
+ *
+ * Records are appended after the operation they describe has been applied,
+ * as they hold its outcome.  A crash in between loses that operation, as if
+ * it had never run; replaying never applies one that did not happen.
+ *
+ * Every record is encoded as an operation byte, then the position of the
+ * queue in the chain, the argument and the length of the string as varints,
+ * the string bytes and a 32-bit checksum of everything before it.  Records
+ * are buffered and made durable in groups: fsync is issued once
+ * journal_batch records are pending or the oldest pending record has waited
+ * journal_usec microseconds, whichever comes first.  qtest also syncs them
+ * before waiting for input, so no record is left pending while idle.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum {
+    JOURNAL_NEW,
+    JOURNAL_FREE,
+    JOURNAL_IH,
+    JOURNAL_IT,
+    JOURNAL_RH,
+    JOURNAL_RT,
+    JOURNAL_SORT,
+    JOURNAL_REVERSE,
+    JOURNAL_REVERSEK,
+    JOURNAL_SWAP,
+    JOURNAL_DM,
+    JOURNAL_DEDUP,
+    JOURNAL_ASCEND,
+    JOURNAL_DESCEND,
+    JOURNAL_MERGE,
+    JOURNAL_SHUFFLE,
+    JOURNAL_CLONE,
+    JOURNAL_LOAD,
+    JOURNAL_APPEND,
+    N_JOURNAL_OP
+} journal_op_t;
+
+/* A journal record.
+ * @arg holds the repeat count of insertions, or the argument of operations
+ * such as the order of sort or the seed of shuffle.
+ * @str need not be NUL-terminated when appended, but always is when passed
+ * to a replay function.
+ */
+typedef struct {
+    journal_op_t op;
+    unsigned qid;
+    uint64_t arg;
+    const char *str;
+    size_t len;
+} journal_rec_t;
+
+/* Number of records made durable by one fsync */
+extern int journal_batch;
+
+/* Longest time, in microseconds, a record may wait for fsync */
+extern int journal_usec;
+
+/* Function applying one replayed record, returning false on failure */
+typedef bool (*journal_apply_t)(const journal_rec_t *rec);
+
+/* Open journal at path, creating it if needed.  Existing records are first
+ * replayed through apply and counted in *replayed.  A torn or corrupted tail,
+ * as left by a crash, is truncated.
+ * Return false if the file cannot be used or apply fails.
+ */
+bool journal_open(const char *path, journal_apply_t apply, size_t *replayed);
+
+/* Return whether a journal is open */
+bool journal_is_open();
+
+/* Append a record, syncing the pending group when it is due.
+ * Return false for I/O error.
+ */
+bool journal_append(const journal_rec_t *rec);
+
+/* Write and fsync all pending records */
+bool journal_sync();
+
+/* Sync and close the journal */
+void journal_close();
+
+#endif /* LAB0_JOURNAL_H */
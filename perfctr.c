@@ -0,0 +1,134 @@
+/* Hardware performance counters */
+
+#include <string.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+#include "dudect/cpucycles.h"
+#include "perfctr.h"
+
+/* Descriptor of each counter, -1 when not opened.  The first one opened
+ * leads the group.  Counters are only opened on Linux; elsewhere all stay
+ * closed and cycles come from the time-stamp counter.
+ */
+static int fds[N_PERFCTR] = {-1, -1, -1, -1, -1, -1};
+static int leader = -1;
+
+/* Position of each counter among the values read from the group */
+static int slot[N_PERFCTR];
+static int nopen = 0;
+
+#ifdef __linux__
+static const struct {
+    uint32_t type;
+    uint64_t config;
+} events[N_PERFCTR] = {
+    [PERFCTR_TIME] = {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK},
+    [PERFCTR_CYCLES] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    [PERFCTR_INSTRUCTIONS] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    [PERFCTR_L1D_MISSES] = {PERF_TYPE_HW_CACHE,
+                            PERF_COUNT_HW_CACHE_L1D |
+                                (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+    [PERFCTR_LLC_MISSES] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    [PERFCTR_BRANCH_MISSES] = {PERF_TYPE_HARDWARE,
+                               PERF_COUNT_HW_BRANCH_MISSES},
+};
+
+static int open_event(perfctr_event_t e, int group_fd)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = events[e].type;
+    attr.config = events[e].config;
+    attr.disabled = group_fd == -1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                       PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+
+bool perfctr_open()
+{
+    perfctr_close();
+
+    /* A hardware event leads when possible, so the others can join it */
+    for (int pass = 0; pass < 2; pass++) {
+        for (perfctr_event_t e = 0; e < N_PERFCTR; e++) {
+            bool hardware = events[e].type != PERF_TYPE_SOFTWARE;
+            if (fds[e] != -1 || (pass == 0 && !hardware))
+                continue;
+            fds[e] = open_event(e, leader);
+            if (fds[e] == -1)
+                continue;
+            if (leader == -1)
+                leader = fds[e];
+            slot[e] = nopen++;
+        }
+    }
+    if (leader == -1)
+        return false;
+
+    ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+
+    bool hardware = false;
+    for (perfctr_event_t e = 0; e < N_PERFCTR; e++)
+        hardware |= fds[e] != -1 && events[e].type != PERF_TYPE_SOFTWARE;
+    return hardware;
+}
+#else
+bool perfctr_open()
+{
+    return false;
+}
+#endif
+
+bool perfctr_available(perfctr_event_t e)
+{
+    return fds[e] != -1 || e == PERFCTR_CYCLES;
+}
+
+bool perfctr_tsc_cycles()
+{
+    return fds[PERFCTR_CYCLES] == -1;
+}
+
+void perfctr_read(uint64_t v[N_PERFCTR])
+{
+    memset(v, 0, N_PERFCTR * sizeof(uint64_t));
+    if (perfctr_tsc_cycles())
+        v[PERFCTR_CYCLES] = cpucycles();
+    if (leader == -1)
+        return;
+
+    /* nr, time enabled, time running, then one value per counter */
+    uint64_t buf[3 + N_PERFCTR];
+    if (read(leader, buf, sizeof(buf)) < (ssize_t) (3 * sizeof(uint64_t)))
+        return;
+
+    /* Counters multiplexed with others ran for part of the time only */
+    double scale = buf[2] ? (double) buf[1] / buf[2] : 1;
+    for (perfctr_event_t e = 0; e < N_PERFCTR; e++) {
+        if (fds[e] != -1 && slot[e] < (int) buf[0])
+            v[e] = buf[3 + slot[e]] * scale;
+    }
+}
+
+void perfctr_close()
+{
+    for (perfctr_event_t e = 0; e < N_PERFCTR; e++) {
+        if (fds[e] != -1)
+            close(fds[e]);
+        fds[e] = -1;
+    }
+    leader = -1;
+    nopen = 0;
+}
@@ -0,0 +1,42 @@
+#ifndef LAB0_PERFCTR_H
+#define LAB0_PERFCTR_H
+
+/* Hardware performance counters of the calling thread, in user mode.
+ *
+ * The counters are opened as one perf_event group, so they are read together
+ * with a single system call and scaled alike when the kernel multiplexes
+ * them.  Counters the machine or the kernel does not provide are left out,
+ * and cycles are then taken from the time-stamp counter.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef enum {
+    PERFCTR_TIME, /* Nanoseconds of CPU time */
+    PERFCTR_CYCLES,
+    PERFCTR_INSTRUCTIONS,
+    PERFCTR_L1D_MISSES,
+    PERFCTR_LLC_MISSES,
+    PERFCTR_BRANCH_MISSES,
+    N_PERFCTR
+} perfctr_event_t;
+
+/* Open the counters.
+ * Return false if no hardware counter could be opened.
+ */
+bool perfctr_open();
+
+/* Whether event e is counted, rather than reported as 0 */
+bool perfctr_available(perfctr_event_t e);
+
+/* Whether cycles come from the time-stamp counter rather than the PMU */
+bool perfctr_tsc_cycles();
+
+/* Store the current value of every counter in v */
+void perfctr_read(uint64_t v[N_PERFCTR]);
+
+/* Close the counters */
+void perfctr_close();
+
+#endif /* LAB0_PERFCTR_H */
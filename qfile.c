@@ -0,0 +1,159 @@
+/* Persistent storage of queues in a binary file */
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "qfile.h"
+#include "queue.h"
+
+#define QFILE_MAGIC "LAB0QUE"
+#define QFILE_VERSION 1
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;
+    uint64_t count;
+} qfile_header_t;
+
+/* The queue is written to a new file renamed over path once complete, so
+ * that queues loaded from the old file, whose strings point into its
+ * mapping, keep reading its inode instead of faulting on a truncated one.
+ */
+bool qfile_save(const char *path, struct list_head *head)
+{
+    char tmp[PATH_MAX];
+    if (snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path) >= (int) sizeof(tmp))
+        return false;
+    int fd = mkstemp(tmp);
+    if (fd < 0)
+        return false;
+    mode_t mask = umask(0);
+    umask(mask);
+    FILE *f = fchmod(fd, 0666 & ~mask) ? NULL : fdopen(fd, "wb");
+    if (!f) {
+        close(fd);
+        unlink(tmp);
+        return false;
+    }
+
+    /* Order is only known after the last string, so rewrite the header */
+    qfile_header_t hdr = {.magic = QFILE_MAGIC, .version = QFILE_VERSION};
+    bool ok = fwrite(&hdr, sizeof(hdr), 1, f) == 1;
+
+    unsigned flags = QFILE_SORTED | QFILE_SORTED_DESCEND;
+    const char *last = NULL;
+    element_t *e = NULL;
+    list_for_each_entry (e, head, list) {
+        if (!ok)
+            break;
+        if (last) {
+            int cmp = strcmp(last, e->value);
+            if (cmp > 0)
+                flags &= ~QFILE_SORTED;
+            if (cmp < 0)
+                flags &= ~QFILE_SORTED_DESCEND;
+        }
+        last = e->value;
+
+        size_t len = strlen(e->value);
+        uint32_t len32 = len;
+        ok = len == len32 && fwrite(&len32, sizeof(len32), 1, f) == 1 &&
+             fwrite(e->value, 1, len + 1, f) == len + 1;
+        hdr.count++;
+    }
+
+    hdr.flags = flags;
+    ok = ok && fseek(f, 0, SEEK_SET) == 0 &&
+         fwrite(&hdr, sizeof(hdr), 1, f) == 1;
+    ok = (fclose(f) == 0) && ok && rename(tmp, path) == 0;
+    if (!ok)
+        unlink(tmp);
+    return ok;
+}
+
+static void unmap_file(char *base, size_t len)
+{
+    munmap(base, len);
+}
+
+/* Check that every record lies within the mapping and is NUL-terminated */
+static bool validate(const char *base, size_t len, uint64_t count)
+{
+    size_t off = sizeof(qfile_header_t);
+    for (uint64_t i = 0; i < count; i++) {
+        uint32_t slen;
+        if (len - off < sizeof(slen))
+            return false;
+        memcpy(&slen, base + off, sizeof(slen));
+        off += sizeof(slen);
+        if (len - off <= slen || base[off + slen] != '\0')
+            return false;
+        off += (size_t) slen + 1;
+    }
+    return off == len;
+}
+
+long qfile_load(const char *path, struct list_head *head, qfile_info_t *info)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) || st.st_size < (off_t) sizeof(qfile_header_t)) {
+        close(fd);
+        return -1;
+    }
+
+    size_t len = st.st_size;
+    char *base = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+        return -1;
+
+    qfile_header_t hdr;
+    memcpy(&hdr, base, sizeof(hdr));
+    if (memcmp(hdr.magic, QFILE_MAGIC, sizeof(hdr.magic)) ||
+        hdr.version != QFILE_VERSION || !validate(base, len, hdr.count)) {
+        munmap(base, len);
+        return -1;
+    }
+    info->count = hdr.count;
+    info->flags = hdr.flags;
+    /* The records are about to be read in order */
+    madvise(base, len, MADV_SEQUENTIAL);
+
+    strpool_region_t *r = strpool_region_new(base, len, unmap_file);
+    if (!r) {
+        munmap(base, len);
+        return 0;
+    }
+
+    long cnt = 0;
+    size_t off = sizeof(qfile_header_t);
+    for (uint64_t i = 0; i < hdr.count; i++) {
+        uint32_t slen;
+        memcpy(&slen, base + off, sizeof(slen));
+        off += sizeof(slen);
+
+        element_t *e = malloc(sizeof(element_t));
+        if (!e)
+            break;
+        e->value = strpool_region_get(r, base + off);
+        list_add_tail(&e->list, head);
+        off += (size_t) slen + 1;
+        cnt++;
+    }
+
+    /* Drop the reference held while building; unmaps if nothing was used */
+    strpool_region_put(r);
+    return cnt;
+}
@@ -0,0 +1,42 @@
+#ifndef LAB0_QFILE_H
+#define LAB0_QFILE_H
+
+/* Persistent storage of queues in a binary file.
+ *
+ * Layout, in host byte order:
+ *   header:  magic "LAB0QUE" (8 bytes, including the NUL), uint32_t version,
+ *            uint32_t flags, uint64_t number of strings
+ *   records: uint32_t length, then the string bytes and a terminating NUL
+ *
+ * Strings are stored NUL-terminated, so a loaded queue can use them straight
+ * from the mapped file instead of copying each of them to the heap.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "list.h"
+
+/* Strings in file are in ascending or descending order, respectively */
+#define QFILE_SORTED 0x1
+#define QFILE_SORTED_DESCEND 0x2
+
+/* Write the strings of queue to file.
+ * Return false for I/O error.
+ */
+bool qfile_save(const char *path, struct list_head *head);
+
+/* Description of a queue file */
+typedef struct {
+    size_t count;   /* Number of strings stored */
+    unsigned flags; /* Order of the strings, see QFILE_SORTED */
+} qfile_info_t;
+
+/* Map file, describe it in *info and append its strings to the tail of
+ * queue without copying them.
+ * Return the number of elements appended, which is less than info->count if
+ * allocation failed, or -1 if the file is invalid and the queue is untouched.
+ */
+long qfile_load(const char *path, struct list_head *head, qfile_info_t *info);
+
+#endif /* LAB0_QFILE_H */
@@ -0,0 +1,232 @@
+/* Membership index of the strings in a queue */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "harness.h"
+#include "qindex.h"
+
+#define MIN_SLOTS 16
+
+/* Slots per word of the Bloom filter */
+#define SLOTS_PER_WORD 8
+
+/* Bits set in the filter for each string, all within one word */
+#define BLOOM_PROBES 4
+
+typedef struct {
+    size_t hash;
+    size_t count; /* Elements with the value, 0 for an empty slot */
+    element_t *e; /* One of them, NULL once the value is held in copy */
+    char *copy;
+} qindex_slot_t;
+
+struct __qindex {
+    qindex_slot_t *slots;
+    size_t mask;  /* Number of slots minus one */
+    size_t used;  /* Slots holding a value */
+    uint64_t *bloom;
+    size_t stale; /* Values dropped since the filter was built */
+};
+
+static inline const char *slot_value(const qindex_slot_t *slot)
+{
+    return slot->e ? slot->e->value : slot->copy;
+}
+
+static size_t bloom_words(size_t nslots)
+{
+    return nslots / SLOTS_PER_WORD;
+}
+
+/* Find the word of the filter for hash and the bits standing for it there */
+static uint64_t *bloom_probe(const qindex_t *idx, size_t hash, uint64_t *bits)
+{
+    uint64_t g = (uint64_t) hash * 0x9e3779b97f4a7c15ULL;
+    *bits = 0;
+    for (int i = 0; i < BLOOM_PROBES; i++)
+        *bits |= 1ULL << ((g >> (6 * i)) & 63);
+    return &idx->bloom[(g >> 32) & (bloom_words(idx->mask + 1) - 1)];
+}
+
+static void bloom_add(qindex_t *idx, size_t hash)
+{
+    uint64_t bits;
+    *bloom_probe(idx, hash, &bits) |= bits;
+}
+
+static void bloom_build(qindex_t *idx)
+{
+    memset(idx->bloom, 0, bloom_words(idx->mask + 1) * sizeof(uint64_t));
+    for (size_t i = 0; i <= idx->mask; i++) {
+        if (idx->slots[i].count)
+            bloom_add(idx, idx->slots[i].hash);
+    }
+    idx->stale = 0;
+}
+
+/* Find the slot of value s, or the empty slot ending its probe run */
+static qindex_slot_t *slot_find(const qindex_t *idx, size_t hash, const char *s)
+{
+    size_t i = hash & idx->mask;
+    for (; idx->slots[i].count; i = (i + 1) & idx->mask) {
+        const char *v = slot_value(&idx->slots[i]);
+        if (idx->slots[i].hash == hash && (v == s || !strcmp(v, s)))
+            break;
+    }
+    return &idx->slots[i];
+}
+
+/* Move the values to a table of nslots slots and rebuild the filter */
+static bool resize(qindex_t *idx, size_t nslots)
+{
+    qindex_slot_t *slots = calloc(nslots, sizeof(qindex_slot_t));
+    uint64_t *bloom = malloc(bloom_words(nslots) * sizeof(uint64_t));
+    if (!slots || !bloom) {
+        free(slots);
+        free(bloom);
+        return false;
+    }
+
+    if (idx->slots) {
+        for (size_t i = 0; i <= idx->mask; i++) {
+            if (!idx->slots[i].count)
+                continue;
+            size_t j = idx->slots[i].hash & (nslots - 1);
+            while (slots[j].count)
+                j = (j + 1) & (nslots - 1);
+            slots[j] = idx->slots[i];
+        }
+    }
+    free(idx->slots);
+    free(idx->bloom);
+    idx->slots = slots;
+    idx->bloom = bloom;
+    idx->mask = nslots - 1;
+    bloom_build(idx);
+    return true;
+}
+
+/* Count e under its value, taking a new slot for a value not seen yet */
+static void slot_add(qindex_t *idx, element_t *e)
+{
+    size_t hash = strpool_hash(e->value);
+    qindex_slot_t *slot = slot_find(idx, hash, e->value);
+    if (!slot->count) {
+        slot->hash = hash;
+        slot->e = e;
+        slot->copy = NULL;
+        bloom_add(idx, hash);
+        idx->used++;
+    }
+    slot->count++;
+}
+
+qindex_t *qindex_new(struct list_head *head)
+{
+    size_t n = 0;
+    struct list_head *node;
+    list_for_each (node, head)
+        n++;
+
+    /* Keep the table at most half full */
+    size_t nslots = MIN_SLOTS;
+    while (nslots < 2 * n)
+        nslots *= 2;
+
+    qindex_t *idx = malloc(sizeof(qindex_t));
+    if (!idx)
+        return NULL;
+    idx->slots = NULL;
+    idx->bloom = NULL;
+    idx->used = 0;
+    if (!resize(idx, nslots)) {
+        free(idx);
+        return NULL;
+    }
+
+    element_t *e;
+    list_for_each_entry (e, head, list)
+        slot_add(idx, e);
+    return idx;
+}
+
+bool qindex_add(qindex_t *idx, element_t *e)
+{
+    if (2 * (idx->used + 1) > idx->mask + 1 &&
+        !resize(idx, 2 * (idx->mask + 1)))
+        return false;
+    slot_add(idx, e);
+    return true;
+}
+
+bool qindex_del(qindex_t *idx, element_t *e)
+{
+    qindex_slot_t *slot = slot_find(idx, strpool_hash(e->value), e->value);
+    if (!slot->count)
+        return true;
+
+    if (--slot->count) {
+        /* Other elements keep the value, which must outlive e */
+        if (slot->e == e) {
+            slot->copy = strdup(e->value);
+            slot->e = NULL;
+            if (!slot->copy) {
+                slot->count++;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /* Shift back the following slots of the probe run over the hole, so
+     * lookups need no tombstones.  A slot moves unless its home lies
+     * cyclically in (hole, slot].
+     */
+    size_t mask = idx->mask;
+    size_t i = slot - idx->slots;
+    free(slot->copy);
+    for (size_t j = (i + 1) & mask; idx->slots[j].count; j = (j + 1) & mask) {
+        size_t home = idx->slots[j].hash & mask;
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            idx->slots[i] = idx->slots[j];
+            i = j;
+        }
+    }
+    idx->slots[i].count = 0;
+    idx->used--;
+
+    /* Shrink a mostly empty table, which also rebuilds the filter.
+     * Otherwise rebuild the filter once a quarter of the table's worth of
+     * values has been dropped, so its cost is spread over those removals.
+     */
+    size_t nslots = mask + 1;
+    if (nslots > MIN_SLOTS && 8 * idx->used < nslots &&
+        resize(idx, nslots / 2))
+        return true;
+    if (4 * ++idx->stale > nslots)
+        bloom_build(idx);
+    return true;
+}
+
+bool qindex_contains(const qindex_t *idx, const char *s)
+{
+    size_t hash = strpool_hash(s);
+    uint64_t bits;
+    if ((*bloom_probe(idx, hash, &bits) & bits) != bits)
+        return false;
+    return slot_find(idx, hash, s)->count;
+}
+
+void qindex_free(qindex_t *idx)
+{
+    if (!idx)
+        return;
+    for (size_t i = 0; i <= idx->mask; i++) {
+        if (idx->slots[i].count)
+            free(idx->slots[i].copy);
+    }
+    free(idx->slots);
+    free(idx->bloom);
+    free(idx);
+}
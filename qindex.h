@@ -0,0 +1,44 @@
+#ifndef LAB0_QINDEX_H
+#define LAB0_QINDEX_H
+
+/* Membership index of the strings in a queue.
+ *
+ * Distinct strings are kept in an open-addressing hash table probed
+ * linearly, each slot counting the elements holding its string, so the index
+ * follows the queue as a multiset however often a value repeats.  A slot reads
+ * its string through one of those elements, or a private copy once that one
+ * is removed.  A blocked Bloom filter, a fraction of the size of the table, is
+ * checked first so most lookups of absent strings touch one word of it and
+ * never reach the table.  The filter cannot forget, so it is rebuilt once a
+ * quarter of the table's worth of strings has left the index, and the table
+ * shrinks when mostly empty.
+ */
+
+#include <stdbool.h>
+
+#include "queue.h"
+
+typedef struct __qindex qindex_t;
+
+/* Build the index of the elements of queue.
+ * Return NULL for allocation failed.
+ */
+qindex_t *qindex_new(struct list_head *head);
+
+/* Add element e, already in the queue.
+ * Return false for allocation failed, which leaves the index out of date.
+ */
+bool qindex_add(qindex_t *idx, element_t *e);
+
+/* Remove element e, still holding its value.
+ * Return false for allocation failed, which leaves the index out of date.
+ */
+bool qindex_del(qindex_t *idx, element_t *e);
+
+/* Return whether some element has value s */
+bool qindex_contains(const qindex_t *idx, const char *s);
+
+/* Release the index */
+void qindex_free(qindex_t *idx);
+
+#endif /* LAB0_QINDEX_H */
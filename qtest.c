@@ -3,6 +3,7 @@
 #include <assert.h>
 #include <errno.h>
 #include <getopt.h>
+#include <pthread.h>
 #include <signal.h>
 #include <spawn.h>
 #include <stdio.h>
@@ -45,6 +46,11 @@ extern int show_entropy;
 #include "queue.h"
 
 #include "console.h"
+#include "evlog.h"
+#include "fcode.h"
+#include "journal.h"
+#include "perfctr.h"
+#include "qfile.h"
 #include "report.h"
 
 /* Settable parameters */
@@ -64,6 +70,16 @@ typedef struct {
     int size;
 } queue_chain_t;
 
+/* A queue in the chain.  Once compacted, its strings are kept front-coded in
+ * packed and its list stays empty until a command needs the elements back.
+ */
+typedef struct {
+    queue_contex_t ctx;
+    fcode_t *packed;
+} qtest_contex_t;
+
+#define packed_of(qctx) (container_of(qctx, qtest_contex_t, ctx)->packed)
+
 static queue_chain_t chain = {.size = 0};
 static queue_contex_t *current = NULL;
 
@@ -87,6 +103,110 @@ typedef enum {
 /* Forward declarations */
 static bool q_show(int vlevel);
 void timsort(void *priv, struct list_head *head, bool descend);
+uintptr_t os_random(uintptr_t seed);
+
+/* Append queue to the chain and make it the current one */
+static queue_contex_t *chain_add(struct list_head *q, int size)
+{
+    qtest_contex_t *tctx = malloc(sizeof(qtest_contex_t));
+    queue_contex_t *qctx = &tctx->ctx;
+    tctx->packed = NULL;
+    list_add_tail(&qctx->chain, &chain.head);
+    qctx->size = size;
+    qctx->q = q;
+    qctx->id = chain.size++;
+    current = qctx;
+    return qctx;
+}
+
+/* Return the queue following qctx in the chain, wrapping around */
+static queue_contex_t *chain_next(const queue_contex_t *qctx)
+{
+    if (chain.size < 2)
+        return NULL;
+    struct list_head *next =
+        qctx->chain.next == &chain.head ? chain.head.next : qctx->chain.next;
+    return list_entry(next, queue_contex_t, chain);
+}
+
+/* Drop the queues left empty by q_merge, whose result has len elements */
+static void chain_merged(int len)
+{
+    if (q_size(&chain.head) <= 1)
+        return;
+
+    chain.size = 1;
+    current = list_entry(chain.head.next, queue_contex_t, chain);
+    current->size = len;
+
+    struct list_head *cur = chain.head.next->next;
+    while ((uintptr_t) cur != (uintptr_t) &chain.head) {
+        queue_contex_t *ctx = list_entry(cur, queue_contex_t, chain);
+        cur = cur->next;
+        q_free(ctx->q);
+        free(ctx);
+    }
+
+    chain.head.prev = &current->chain;
+    current->chain.next = &chain.head;
+}
+
+static bool expand_visit(const char *s, void *priv)
+{
+    return q_insert_tail(priv, (char *) s);
+}
+
+/* Bring back the elements of a compacted queue for a command using them */
+static bool queue_expand(queue_contex_t *qctx)
+{
+    if (!qctx || !packed_of(qctx))
+        return true;
+
+    /* Expansion is not under test, so keep failure injection out of it */
+    int probability = fail_probability;
+    fail_probability = 0;
+    bool ok = fcode_walk(packed_of(qctx), expand_visit, qctx->q);
+    fail_probability = probability;
+    if (!ok) {
+        report(1, "ERROR: Could not expand compacted queue");
+        return false;
+    }
+
+    if (qctx->size > BIG_LIST_SIZE)
+        set_cautious_mode(false);
+    fcode_free(packed_of(qctx));
+    set_cautious_mode(true);
+    packed_of(qctx) = NULL;
+    return true;
+}
+
+/* Record an operation applied to the current queue in the journal.  Records
+ * carry the outcome, such as how many insertions succeeded, so they are
+ * appended once the operation is done rather than ahead of it.
+ */
+static void journal_queue_op(journal_op_t op, uint64_t arg, const char *str)
+{
+    if (!journal_is_open())
+        return;
+
+    journal_rec_t rec = {
+        .op = op,
+        .qid = 0,
+        .arg = arg,
+        .str = str,
+        .len = str ? strlen(str) : 0,
+    };
+    struct list_head *cur;
+    list_for_each (cur, &chain.head) {
+        if (cur == &current->chain)
+            break;
+        rec.qid++;
+    }
+
+    /* Continuing would leave the journal behind the queues */
+    if (!journal_append(&rec))
+        report_event(MSG_FATAL, "Couldn't write journal: %s", strerror(errno));
+}
 
 static bool do_free(int argc, char *argv[])
 {
@@ -106,25 +226,23 @@ static bool do_free(int argc, char *argv[])
     if (current && current->size > BIG_LIST_SIZE)
         set_cautious_mode(false);
 
-    struct list_head *qnext = NULL;
-    if (chain.size > 1) {
-        qnext = (current->chain.next == &chain.head) ? chain.head.next
-                                                     : current->chain.next;
-    }
-
+    queue_contex_t *qnext = NULL;
     if (current) {
+        qnext = chain_next(current);
+        journal_queue_op(JOURNAL_FREE, 0, NULL);
         list_del(&current->chain);
 
         if (exception_setup(true))
             q_free(current->q);
         exception_cancel();
+        fcode_free(packed_of(current));
         set_cautious_mode(true);
     }
 
     if (current) {
         free(current);
         chain.size--;
-        current = qnext ? list_entry(qnext, queue_contex_t, chain) : NULL;
+        current = qnext;
     }
 
     q_show(3);
@@ -150,21 +268,148 @@ static bool do_new(int argc, char *argv[])
     bool ok = true;
 
     if (exception_setup(true)) {
-        queue_contex_t *qctx = malloc(sizeof(queue_contex_t));
-        list_add_tail(&qctx->chain, &chain.head);
+        chain_add(q_new(), 0);
+        journal_queue_op(JOURNAL_NEW, 0, NULL);
+    }
+    exception_cancel();
+    q_show(3);
 
-        qctx->size = 0;
-        qctx->q = q_new();
-        qctx->id = chain.size++;
+    return ok && !error_check();
+}
+
+static bool do_clone(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
+    }
 
-        current = qctx;
+    if (!current || !current->q) {
+        report(3, "Warning: Calling clone on null queue");
+        return false;
     }
+    error_check();
+
+    if (!queue_expand(current))
+        return false;
+
+    /* Sharing a private string frees it, like freeing a big queue does */
+    if (current->size > BIG_LIST_SIZE)
+        set_cautious_mode(false);
+
+    struct list_head *copy = NULL;
+    if (exception_setup(true))
+        copy = q_clone(current->q);
     exception_cancel();
-    q_show(3);
+    set_cautious_mode(true);
 
+    if (!copy) {
+        fail_count++;
+        if (fail_count < fail_limit) {
+            report(2, "Cloning of queue failed");
+            return !error_check();
+        }
+        report(1, "ERROR: Cloning of queue failed (%d failures total)",
+               fail_count);
+        return false;
+    }
+
+    /* Ensure the copy holds the same strings in the same order */
+    bool ok = true;
+    struct list_head *cur_o = current->q->next, *cur_c = copy->next;
+    while (cur_o != current->q && cur_c != copy) {
+        const element_t *item_o = list_entry(cur_o, element_t, list);
+        const element_t *item_c = list_entry(cur_c, element_t, list);
+        if (strcmp(item_o->value, item_c->value)) {
+            ok = false;
+            break;
+        }
+        cur_o = cur_o->next;
+        cur_c = cur_c->next;
+    }
+    ok = ok && cur_o == current->q && cur_c == copy;
+    if (!ok)
+        report(1, "ERROR: Cloned queue differs from the original one");
+
+    journal_queue_op(JOURNAL_CLONE, 0, NULL);
+    chain_add(copy, current->size);
+
+    q_show(3);
     return ok && !error_check();
 }
 
+static bool do_save(int argc, char *argv[])
+{
+    if (argc != 2) {
+        report(1, "%s needs 1 argument", argv[0]);
+        return false;
+    }
+
+    if (!current || !current->q) {
+        report(3, "Warning: Calling save on null queue");
+        return false;
+    }
+
+    if (!queue_expand(current))
+        return false;
+
+    if (!qfile_save(argv[1], current->q)) {
+        report(1, "Couldn't save queue to file '%s'", argv[1]);
+        return false;
+    }
+    report(2, "Saved %d elements to '%s'", current->size, argv[1]);
+    return true;
+}
+
+static bool do_load(int argc, char *argv[])
+{
+    if (argc != 2) {
+        report(1, "%s needs 1 argument", argv[0]);
+        return false;
+    }
+    error_check();
+
+    struct list_head *q = NULL;
+    qfile_info_t info = {.count = 0};
+    long cnt = 0;
+    if (exception_setup(true)) {
+        q = q_new();
+        if (q)
+            cnt = qfile_load(argv[1], q, &info);
+    }
+    exception_cancel();
+
+    if (cnt < 0) {
+        q_free(q);
+        report(1, "Couldn't load queue from file '%s'", argv[1]);
+        return false;
+    }
+
+    /* Replay reads the file again, so only complete loads join the chain */
+    if (!q || cnt != info.count) {
+        q_free(q);
+        fail_count++;
+        if (fail_count < fail_limit) {
+            report(2, "Loading of '%s' failed after %ld elements", argv[1],
+                   cnt);
+            return !error_check();
+        }
+        report(1, "ERROR: Loading of '%s' failed (%d failures total)",
+               argv[1], fail_count);
+        return false;
+    }
+
+    report(2, "Loaded %ld elements from '%s'%s", cnt, argv[1],
+           info.flags & QFILE_SORTED           ? " (sorted ascending)"
+           : info.flags & QFILE_SORTED_DESCEND ? " (sorted descending)"
+                                               : "");
+    chain_add(q, cnt);
+    journal_queue_op(JOURNAL_LOAD, 0, argv[1]);
+
+    q_show(3);
+    return !error_check();
+}
+
 /* TODO: Add a buf_size check of if the buf_size may be less
  * than MIN_RANDSTR_LEN.
  */
@@ -190,8 +435,11 @@ static bool queue_insert(position_t pos, int argc, char *argv[])
             report(1, "%s does not need arguments in simulation mode", argv[0]);
             return false;
         }
+        /* dudect prints its progress through stdio */
+        report_flush();
         bool ok =
             pos == POS_TAIL ? is_insert_tail_const() : is_insert_head_const();
+        fflush(stdout);
         if (!ok) {
             report(1,
                    "ERROR: Probably not constant time or wrong implementation");
@@ -228,6 +476,11 @@ static bool queue_insert(position_t pos, int argc, char *argv[])
                pos == POS_TAIL ? "tail" : "head");
     error_check();
 
+    if (!queue_expand(current))
+        return false;
+
+    journal_op_t op = pos == POS_TAIL ? JOURNAL_IT : JOURNAL_IH;
+    int size = current ? current->size : 0;
     if (current && exception_setup(true)) {
         for (int r = 0; ok && r < reps; r++) {
             if (need_rand)
@@ -236,6 +489,9 @@ static bool queue_insert(position_t pos, int argc, char *argv[])
                                         : q_insert_head(current->q, inserts);
             if (rval) {
                 current->size++;
+                /* Random strings are logged one by one, others in a batch */
+                if (need_rand)
+                    journal_queue_op(op, 1, inserts);
                 element_t *entry =
                     pos == POS_TAIL
                         ? list_last_entry(current->q, element_t, list)
@@ -250,7 +506,7 @@ static bool queue_insert(position_t pos, int argc, char *argv[])
                            "queue element");
                     ok = false;
                     break;
-                } else if (r == 1 && lasts == cur_inserts) {
+                } else if (r == 1 && lasts == cur_inserts && !intern_mode) {
                     report(1,
                            "ERROR: Need to allocate separate string for each "
                            "queue element");
@@ -274,6 +530,9 @@ static bool queue_insert(position_t pos, int argc, char *argv[])
     }
     exception_cancel();
 
+    if (current && !need_rand && current->size > size)
+        journal_queue_op(op, current->size - size, inserts);
+
     q_show(3);
     return ok;
 }
@@ -290,6 +549,69 @@ static bool do_it(int argc, char *argv[])
     return queue_insert(POS_TAIL, argc, argv);
 }
 
+static bool do_append(int argc, char *argv[])
+{
+    if (argc != 2 && argc != 3) {
+        report(1, "%s needs 1-2 arguments", argv[0]);
+        return false;
+    }
+
+    int reps = 1;
+    if (argc == 3 && !get_int(argv[2], &reps)) {
+        report(1, "Invalid number of appends '%s'", argv[2]);
+        return false;
+    }
+
+    if (!current || !current->q) {
+        report(3, "Warning: Calling append on null queue");
+        return false;
+    }
+    error_check();
+
+    if (!queue_expand(current))
+        return false;
+    if (list_empty(current->q)) {
+        report(1, "ERROR: Calling append on empty queue");
+        return false;
+    }
+
+    /* Check the value grows by the string at each append */
+    element_t *last = list_last_entry(current->q, element_t, list);
+    size_t len = strlen(last->value), slen = strlen(argv[1]);
+    int appended = 0;
+    bool ok = true;
+    if (exception_setup(true)) {
+        for (int r = 0; ok && r < reps; r++) {
+            if (!q_append_value(current->q, argv[1])) {
+                fail_count++;
+                if (fail_count < fail_limit)
+                    report(2, "Append of %s failed", argv[1]);
+                else {
+                    report(1, "ERROR: Append of %s failed (%d failures total)",
+                           argv[1], fail_count);
+                    ok = false;
+                }
+                continue;
+            }
+            appended++;
+            len += slen;
+            if (strlen(last->value) != len ||
+                strcmp(last->value + len - slen, argv[1])) {
+                report(1, "ERROR: Value does not end with appended %s",
+                       argv[1]);
+                ok = false;
+            }
+        }
+    }
+    exception_cancel();
+
+    if (appended)
+        journal_queue_op(JOURNAL_APPEND, appended, argv[1]);
+
+    q_show(3);
+    return ok && !error_check();
+}
+
 static bool queue_remove(position_t pos, int argc, char *argv[])
 {
     /* FIXME: It is known that both functions is_remove_tail_const() and
@@ -302,8 +624,11 @@ static bool queue_remove(position_t pos, int argc, char *argv[])
             report(1, "%s does not need arguments in simulation mode", argv[0]);
             return false;
         }
+        /* dudect prints its progress through stdio */
+        report_flush();
         bool ok =
             pos == POS_TAIL ? is_remove_tail_const() : is_remove_head_const();
+        fflush(stdout);
         if (!ok) {
             report(1,
                    "ERROR: Probably not constant time or wrong implementation");
@@ -351,18 +676,26 @@ static bool queue_remove(position_t pos, int argc, char *argv[])
     error_check();
 
     element_t *re = NULL;
-    if (current && exception_setup(true))
-        re = pos == POS_TAIL
-                 ? q_remove_tail(current->q, removes, string_length + 1)
-                 : q_remove_head(current->q, removes, string_length + 1);
-    exception_cancel();
-
-    bool is_null = re ? false : true;
+    bool is_null = true;
+    if (current && packed_of(current)) {
+        /* Take the string straight from the front-coded storage */
+        is_null = !fcode_remove(packed_of(current), pos == POS_TAIL, removes,
+                                string_length + 1);
+    } else {
+        if (current && exception_setup(true))
+            re = pos == POS_TAIL
+                     ? q_remove_tail(current->q, removes, string_length + 1)
+                     : q_remove_head(current->q, removes, string_length + 1);
+        exception_cancel();
+        is_null = re ? false : true;
+    }
 
     if (!is_null) {
         // q_remove_head and q_remove_tail are not responsible for releasing
         // node
-        q_release_element(re);
+        if (re)
+            q_release_element(re);
+        journal_queue_op(pos == POS_TAIL ? JOURNAL_RT : JOURNAL_RH, 0, NULL);
 
         removes[string_length + STRINGPAD] = '\0';
         if (removes[0] == '\0') {
@@ -431,6 +764,9 @@ static bool do_dedup(int argc, char *argv[])
         return false;
     }
 
+    if (!queue_expand(current))
+        return false;
+
     LIST_HEAD(l_copy);
     element_t *item = NULL, *tmp = NULL;
 
@@ -477,6 +813,7 @@ static bool do_dedup(int argc, char *argv[])
         report(1, "ERROR: Calling delete duplicate on null queue");
         return false;
     }
+    journal_queue_op(JOURNAL_DEDUP, 0, NULL);
 
     struct list_head *l_tmp = current->q->next;
     bool is_this_dup = false;
@@ -525,16 +862,324 @@ static bool do_reverse(int argc, char *argv[])
         report(3, "Warning: Calling reverse on null queue");
     error_check();
 
+    if (!queue_expand(current))
+        return false;
+
     set_noallocate_mode(true);
     if (current && exception_setup(true))
         q_reverse(current->q);
     exception_cancel();
 
     set_noallocate_mode(false);
+    journal_queue_op(JOURNAL_REVERSE, 0, NULL);
+    q_show(3);
+    return !error_check();
+}
+
+static bool do_shuffle(int argc, char *argv[])
+{
+    if (argc != 1 && argc != 2) {
+        report(1, "%s takes 0-1 arguments", argv[0]);
+        return false;
+    }
+
+    int seed = 0;
+    if (argc == 2 && !get_int(argv[1], &seed)) {
+        report(1, "Invalid seed '%s'", argv[1]);
+        return false;
+    }
+
+    if (!current || !current->q) {
+        report(3, "Warning: Calling shuffle on null queue");
+        return false;
+    }
+    error_check();
+
+    if (!queue_expand(current))
+        return false;
+
+    bool ok = true;
+    uintptr_t s = argc == 2 ? (uintptr_t) seed : os_random(getpid());
+    if (exception_setup(true))
+        ok = q_shuffle(current->q, s);
+    exception_cancel();
+
+    if (!ok) {
+        fail_count++;
+        if (fail_count < fail_limit) {
+            report(2, "Shuffling of queue failed");
+            return !error_check();
+        }
+        report(1, "ERROR: Shuffling of queue failed (%d failures total)",
+               fail_count);
+        return false;
+    }
+    journal_queue_op(JOURNAL_SHUFFLE, s, NULL);
+
+    int cnt = q_size(current->q);
+    if (cnt != current->size) {
+        report(1, "ERROR: Queue has %d elements after shuffle, expected %d",
+               cnt, current->size);
+        ok = false;
+    }
+
+    q_show(3);
+    return ok && !error_check();
+}
+
+static bool do_compact(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
+    }
+
+    if (!current || !current->q) {
+        report(3, "Warning: Calling compact on null queue");
+        return false;
+    }
+    error_check();
+
+    if (packed_of(current)) {
+        report(2, "Queue is already compact");
+        return true;
+    }
+
+    /* Count what the elements take, strings shared by neighbours once */
+    bool ascend = true, descend = true;
+    size_t bytes = 0;
+    const char *last = NULL;
+    element_t *e;
+    list_for_each_entry (e, current->q, list) {
+        if (last) {
+            int cmp = strcmp(last, e->value);
+            ascend = ascend && cmp <= 0;
+            descend = descend && cmp >= 0;
+        }
+        bytes += sizeof(element_t);
+        if (e->value != last)
+            bytes += strlen(e->value) + 1;
+        last = e->value;
+    }
+    if (!ascend && !descend) {
+        report(1, "ERROR: Only sorted queues can be compacted");
+        return false;
+    }
+
+    fcode_t *packed = NULL;
+    if (exception_setup(true))
+        packed = fcode_pack(current->q);
+    exception_cancel();
+
+    if (!packed) {
+        fail_count++;
+        if (fail_count < fail_limit) {
+            report(2, "Compaction of queue failed");
+            return !error_check();
+        }
+        report(1, "ERROR: Compaction of queue failed (%d failures total)",
+               fail_count);
+        return false;
+    }
+
+    if (current->size > BIG_LIST_SIZE)
+        set_cautious_mode(false);
+    while ((e = q_remove_head(current->q, NULL, 0)))
+        q_release_element(e);
+    set_cautious_mode(true);
+    packed_of(current) = packed;
+
+    report(2, "Compacted %d elements from %lu to %lu bytes", current->size,
+           bytes, fcode_bytes(packed));
     q_show(3);
     return !error_check();
 }
 
+static bool do_find(int argc, char *argv[])
+{
+    if (argc != 2 && argc != 3) {
+        report(1, "%s needs 1-2 arguments", argv[0]);
+        return false;
+    }
+
+    int reps = 1;
+    if (argc == 3 && !get_int(argv[2], &reps)) {
+        report(1, "Invalid number of lookups '%s'", argv[2]);
+        return false;
+    }
+
+    if (!current || !current->q) {
+        report(3, "Warning: Calling find on null queue");
+        return false;
+    }
+    error_check();
+
+    if (!queue_expand(current))
+        return false;
+
+    bool found = false;
+    if (exception_setup(true)) {
+        for (int r = 0; r < reps; r++)
+            found = q_contains(current->q, argv[1]);
+    }
+    exception_cancel();
+
+    /* Check the answer against a walk of the queue */
+    bool expected = false;
+    element_t *e;
+    list_for_each_entry (e, current->q, list) {
+        if (!strcmp(e->value, argv[1])) {
+            expected = true;
+            break;
+        }
+    }
+    if (found != expected) {
+        report(1, "ERROR: q_contains reports %s %s in queue, but it is%s",
+               argv[1], found ? "is" : "is not", expected ? "" : " not");
+        return false;
+    }
+
+    report(2, "%s is %sin queue", argv[1], found ? "" : "not ");
+    return !error_check();
+}
+
+/* Most threads the 'threads' command starts */
+#define MAX_THREADS 64
+
+/* Point where workers wait for one another, as pthread_barrier_t is not
+ * available everywhere
+ */
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int missing; /* Workers yet to arrive */
+} rendezvous_t;
+
+static void rendezvous_wait(rendezvous_t *r)
+{
+    pthread_mutex_lock(&r->lock);
+    if (!--r->missing)
+        pthread_cond_broadcast(&r->cond);
+    while (r->missing)
+        pthread_cond_wait(&r->cond, &r->lock);
+    pthread_mutex_unlock(&r->lock);
+}
+
+typedef struct {
+    struct list_head *q;
+    int n;
+    rendezvous_t *rendezvous;
+    struct list_head **next_q; /* Queue of the neighbour, freed here */
+    bool ok;
+} worker_t;
+
+/* Build a queue, drain half of it, then free the queue of the neighbour, so
+ * blocks are released by threads other than the one allocating them
+ */
+static void *queue_worker(void *arg)
+{
+    worker_t *w = arg;
+    char buf[32];
+
+    /* Time limits only apply to the main thread, which SIGALRM must reach */
+    sigset_t alrm;
+    sigemptyset(&alrm);
+    sigaddset(&alrm, SIGALRM);
+    pthread_sigmask(SIG_BLOCK, &alrm, NULL);
+
+    w->q = q_new();
+    w->ok = w->q != NULL;
+    for (int i = 0; w->ok && i < w->n; i++) {
+        snprintf(buf, sizeof(buf), "v%d", i);
+        w->ok = i & 1 ? q_insert_tail(w->q, buf) : q_insert_head(w->q, buf);
+    }
+    for (int i = 0; w->ok && i < w->n / 2; i++) {
+        element_t *e = q_remove_head(w->q, NULL, 0);
+        w->ok = e != NULL;
+        if (e)
+            q_release_element(e);
+    }
+
+    rendezvous_wait(w->rendezvous);
+    q_free(*w->next_q);
+    return NULL;
+}
+
+static bool do_threads(int argc, char *argv[])
+{
+    if (argc != 3) {
+        report(1, "%s needs 2 arguments", argv[0]);
+        return false;
+    }
+
+    int nthreads, n;
+    if (!get_int(argv[1], &nthreads) || nthreads < 1 ||
+        nthreads > MAX_THREADS) {
+        report(1, "Invalid number of threads '%s'", argv[1]);
+        return false;
+    }
+    if (!get_int(argv[2], &n) || n < 0) {
+        report(1, "Invalid number of elements '%s'", argv[2]);
+        return false;
+    }
+
+    /* The intern table is shared by all queues and has no lock */
+    if (intern_mode) {
+        report(1, "ERROR: threads cannot run with interning enabled");
+        return false;
+    }
+    error_check();
+
+    size_t before = allocation_check();
+    int probability = fail_probability;
+    fail_probability = 0;
+
+    worker_t workers[MAX_THREADS];
+    pthread_t tids[MAX_THREADS];
+    rendezvous_t rendezvous = {
+        .lock = PTHREAD_MUTEX_INITIALIZER,
+        .cond = PTHREAD_COND_INITIALIZER,
+        .missing = nthreads,
+    };
+    int started = 0;
+    for (; started < nthreads; started++) {
+        worker_t *w = &workers[started];
+        w->n = n;
+        w->rendezvous = &rendezvous;
+        w->next_q = &workers[(started + 1) % nthreads].q;
+        if (pthread_create(&tids[started], NULL, queue_worker, w))
+            break;
+    }
+    /* The workers started would wait forever for the others */
+    if (started < nthreads)
+        report_event(MSG_FATAL, "Couldn't start %d threads", nthreads);
+
+    bool ok = true;
+    for (int i = 0; i < nthreads; i++) {
+        pthread_join(tids[i], NULL);
+        ok = ok && workers[i].ok;
+    }
+    pthread_mutex_destroy(&rendezvous.lock);
+    pthread_cond_destroy(&rendezvous.cond);
+    fail_probability = probability;
+
+    if (!ok) {
+        report(1, "ERROR: Queue operation failed in a thread");
+        return false;
+    }
+
+    size_t after = allocation_check();
+    if (after != before) {
+        report(1, "ERROR: %ld blocks leaked by threads",
+               (long) after - (long) before);
+        return false;
+    }
+
+    report(2, "%d threads built and freed queues of %d elements", nthreads,
+           n);
+    return !error_check();
+}
+
 static bool do_size(int argc, char *argv[])
 {
     if (argc != 1 && argc != 2) {
@@ -561,7 +1206,8 @@ static bool do_size(int argc, char *argv[])
 
     if (current && exception_setup(true)) {
         for (int r = 0; ok && r < reps; r++) {
-            cnt = q_size(current->q);
+            cnt = packed_of(current) ? fcode_count(packed_of(current))
+                                     : q_size(current->q);
             ok = ok && !error_check();
         }
     }
@@ -590,6 +1236,9 @@ bool do_sort(int argc, char *argv[])
         return false;
     }
 
+    if (!queue_expand(current))
+        return false;
+
     int cnt = 0;
     if (!current || !current->q)
         report(3, "Warning: Calling sort on null queue");
@@ -611,6 +1260,8 @@ bool do_sort(int argc, char *argv[])
     }
     exception_cancel();
     set_noallocate_mode(false);
+    if (current)
+        journal_queue_op(JOURNAL_SORT, descend, NULL);
 
     bool ok = true;
     if (current && current->size) {
@@ -651,11 +1302,17 @@ static bool do_dm(int argc, char *argv[])
     }
     error_check();
 
+    if (!queue_expand(current))
+        return false;
+
     bool ok = true;
     if (exception_setup(true))
         ok = q_delete_mid(current->q);
     exception_cancel();
 
+    if (ok && current->size)
+        journal_queue_op(JOURNAL_DM, 0, NULL);
+
     if (!current->size)
         report(3, "Warning: Try to delete middle node to empty queue");
     else
@@ -677,12 +1334,16 @@ static bool do_swap(int argc, char *argv[])
     }
     error_check();
 
+    if (!queue_expand(current))
+        return false;
+
     set_noallocate_mode(true);
     if (exception_setup(true))
         q_swap(current->q);
     exception_cancel();
 
     set_noallocate_mode(false);
+    journal_queue_op(JOURNAL_SWAP, 0, NULL);
 
     q_show(3);
     return !error_check();
@@ -702,6 +1363,9 @@ static bool do_ascend(int argc, char *argv[])
     }
     error_check();
 
+    if (!queue_expand(current))
+        return false;
+
 
     int cnt = q_size(current->q);
     if (!cnt)
@@ -712,7 +1376,9 @@ static bool do_ascend(int argc, char *argv[])
 
     if (exception_setup(true))
         current->size = q_ascend(current->q);
+    exception_cancel();
     set_noallocate_mode(false);
+    journal_queue_op(JOURNAL_ASCEND, 0, NULL);
 
     bool ok = true;
 
@@ -749,6 +1415,9 @@ static bool do_descend(int argc, char *argv[])
     }
     error_check();
 
+    if (!queue_expand(current))
+        return false;
+
 
     int cnt = q_size(current->q);
     if (!cnt)
@@ -759,7 +1428,9 @@ static bool do_descend(int argc, char *argv[])
 
     if (exception_setup(true))
         current->size = q_descend(current->q);
+    exception_cancel();
     set_noallocate_mode(false);
+    journal_queue_op(JOURNAL_DESCEND, 0, NULL);
 
     bool ok = true;
 
@@ -803,12 +1474,16 @@ static bool do_reverseK(int argc, char *argv[])
         return false;
     }
 
+    if (!queue_expand(current))
+        return false;
+
     set_noallocate_mode(true);
     if (exception_setup(true))
         q_reverseK(current->q, k);
     exception_cancel();
 
     set_noallocate_mode(false);
+    journal_queue_op(JOURNAL_REVERSEK, k, NULL);
     q_show(3);
     return !error_check();
 }
@@ -826,29 +1501,22 @@ static bool do_merge(int argc, char *argv[])
     }
     error_check();
 
+    queue_contex_t *qctx;
+    list_for_each_entry (qctx, &chain.head, chain) {
+        if (!queue_expand(qctx))
+            return false;
+    }
+
     int len = 0;
     set_noallocate_mode(true);
     if (current && exception_setup(true))
         len = q_merge(&chain.head, descend);
     exception_cancel();
     set_noallocate_mode(false);
+    if (current)
+        journal_queue_op(JOURNAL_MERGE, descend, NULL);
 
-    if (q_size(&chain.head) > 1) {
-        chain.size = 1;
-        current = list_entry(chain.head.next, queue_contex_t, chain);
-        current->size = len;
-
-        struct list_head *cur = chain.head.next->next;
-        while ((uintptr_t) cur != (uintptr_t) &chain.head) {
-            queue_contex_t *ctx = list_entry(cur, queue_contex_t, chain);
-            cur = cur->next;
-            q_free(ctx->q);
-            free(ctx);
-        }
-
-        chain.head.prev = &current->chain;
-        current->chain.next = &chain.head;
-    }
+    chain_merged(len);
 
     bool ok = true;
     if (current && current->size) {
@@ -902,6 +1570,21 @@ static bool is_circular()
     return true;
 }
 
+typedef struct {
+    int vlevel;
+    int cnt;
+} show_state_t;
+
+static bool show_visit(const char *s, void *priv)
+{
+    show_state_t *st = priv;
+    report_noreturn(st->vlevel, st->cnt == 0 ? "%s" : " %s", s);
+    if (show_entropy)
+        report_noreturn(st->vlevel, "(%3.2f%%)",
+                        shannon_entropy((const uint8_t *) s));
+    return ++st->cnt < BIG_LIST_SIZE;
+}
+
 static bool q_show(int vlevel)
 {
     bool ok = true;
@@ -914,6 +1597,17 @@ static bool q_show(int vlevel)
         return true;
     }
 
+    if (packed_of(current)) {
+        /* Decode only the strings on display */
+        show_state_t st = {.vlevel = vlevel, .cnt = 0};
+        report_noreturn(vlevel, "l = [");
+        fcode_walk(packed_of(current), show_visit, &st);
+        report(vlevel, fcode_count(packed_of(current)) > BIG_LIST_SIZE
+                           ? " ... ]"
+                           : "]");
+        return true;
+    }
+
     if (!is_circular()) {
         report(vlevel, "ERROR:  Queue is not doubly circular");
         return false;
@@ -975,6 +1669,172 @@ static bool do_show(int argc, char *argv[])
     return q_show(0);
 }
 
+static bool do_memprof(int argc, char *argv[])
+{
+    if (argc > 2 || (argc == 2 && strcmp(argv[1], "reset"))) {
+        report(1, "%s takes no arguments or 'reset'", argv[0]);
+        return false;
+    }
+
+    if (argc == 2) {
+        memprof_reset();
+        return true;
+    }
+    if (!memprof_mode)
+        report(1, "Profiling is off.  Turn it on with 'option memprof 1'");
+    memprof_report();
+    return true;
+}
+
+/* Hardware counter totals of each command run while perf_mode is set */
+#define MAX_PERF_CMDS 128
+
+typedef struct {
+    const char *name;
+    uint64_t runs;
+    uint64_t sum[N_PERFCTR];
+} perf_entry_t;
+
+static int perf_mode = 0;
+static perf_entry_t perf_table[MAX_PERF_CMDS];
+static int perf_ncmds = 0;
+
+static perf_entry_t *perf_entry(const char *name)
+{
+    for (int i = 0; i < perf_ncmds; i++) {
+        if (perf_table[i].name == name)
+            return &perf_table[i];
+    }
+    if (perf_ncmds == MAX_PERF_CMDS)
+        return NULL;
+    perf_entry_t *pe = &perf_table[perf_ncmds++];
+    memset(pe, 0, sizeof(perf_entry_t));
+    pe->name = name;
+    return pe;
+}
+
+static void perf_changed(int oldval)
+{
+    if (!perf_mode) {
+        perfctr_close();
+        return;
+    }
+    if (!oldval && !perfctr_open())
+        report(1, "Hardware counters unavailable, counting cycles of the "
+                  "time-stamp counter only");
+}
+
+/* Commands run within others, as by 'time', nest a few levels deep */
+#define MAX_CMD_DEPTH 4
+
+static struct {
+    const char *name;
+    bool counted; /* Whether start holds the counters at its start */
+    uint64_t start[N_PERFCTR];
+} cmd_stack[MAX_CMD_DEPTH];
+static int cmd_depth = 0;
+
+/* Make pending journal records durable before waiting for input: no more
+ * will join their group until the user types, and the process may be killed
+ * meanwhile.  The timer of timer mode serves the script that just ran, and
+ * its ticks would interrupt the wait.
+ */
+static void console_idle()
+{
+    if (journal_is_open() && !journal_sync())
+        report_event(MSG_FATAL, "Couldn't write journal: %s", strerror(errno));
+    exception_timer_stop();
+}
+
+/* Credit what each command does to its name */
+static void cmd_hook(const char *name)
+{
+    if (name) {
+        if (cmd_depth < MAX_CMD_DEPTH) {
+            cmd_stack[cmd_depth].name = name;
+            cmd_stack[cmd_depth].counted = perf_mode;
+            if (perf_mode)
+                perfctr_read(cmd_stack[cmd_depth].start);
+        }
+        cmd_depth++;
+        memprof_tag(name);
+        return;
+    }
+
+    if (--cmd_depth < MAX_CMD_DEPTH && perf_mode &&
+        cmd_stack[cmd_depth].counted) {
+        uint64_t end[N_PERFCTR];
+        perfctr_read(end);
+        perf_entry_t *pe = perf_entry(cmd_stack[cmd_depth].name);
+        if (pe) {
+            pe->runs++;
+            for (int e = 0; e < N_PERFCTR; e++)
+                pe->sum[e] += end[e] - cmd_stack[cmd_depth].start[e];
+        }
+    }
+    memprof_tag(cmd_depth > 0 && cmd_depth <= MAX_CMD_DEPTH
+                    ? cmd_stack[cmd_depth - 1].name
+                    : NULL);
+}
+
+/* Sample the current queue and allocated blocks for the event log */
+static void evlog_probe(evlog_sample_t *s)
+{
+    s->qid = current ? current->id : -1;
+    s->blocks = allocation_check();
+}
+
+/* Print the mean of counter e per run of pe, or '-' if not counted */
+static void perf_column(const perf_entry_t *pe, perfctr_event_t e, double div)
+{
+    if (perfctr_available(e))
+        report_noreturn(1, " %12.1f", (double) pe->sum[e] / pe->runs / div);
+    else
+        report_noreturn(1, " %12s", "-");
+}
+
+static bool do_perf(int argc, char *argv[])
+{
+    if (argc > 2 || (argc == 2 && strcmp(argv[1], "reset"))) {
+        report(1, "%s takes no arguments or 'reset'", argv[0]);
+        return false;
+    }
+
+    if (argc == 2) {
+        perf_ncmds = 0;
+        return true;
+    }
+    if (!perf_mode) {
+        report(1, "Counting is off.  Turn it on with 'option perf 1'");
+        return true;
+    }
+
+    report(1, "%-10s %8s %12s %12s %12s %6s %12s %12s %12s", "per run", "runs",
+           "usec", perfctr_tsc_cycles() ? "tsc cycles" : "cycles",
+           "instructions", "IPC", "L1D misses", "LLC misses", "br misses");
+    for (int i = 0; i < perf_ncmds; i++) {
+        const perf_entry_t *pe = &perf_table[i];
+        if (!pe->runs)
+            continue;
+        report_noreturn(1, "%-10s %8lu", pe->name, (unsigned long) pe->runs);
+        perf_column(pe, PERFCTR_TIME, 1000);
+        perf_column(pe, PERFCTR_CYCLES, 1);
+        perf_column(pe, PERFCTR_INSTRUCTIONS, 1);
+        if (perfctr_available(PERFCTR_INSTRUCTIONS) &&
+            !perfctr_tsc_cycles() && pe->sum[PERFCTR_CYCLES])
+            report_noreturn(1, " %6.2f",
+                            (double) pe->sum[PERFCTR_INSTRUCTIONS] /
+                                pe->sum[PERFCTR_CYCLES]);
+        else
+            report_noreturn(1, " %6s", "-");
+        perf_column(pe, PERFCTR_L1D_MISSES, 1);
+        perf_column(pe, PERFCTR_LLC_MISSES, 1);
+        perf_column(pe, PERFCTR_BRANCH_MISSES, 1);
+        report(1, "");
+    }
+    return true;
+}
+
 static bool do_prev(int argc, char *argv[])
 {
     if (argc != 1) {
@@ -1021,10 +1881,133 @@ static bool do_next(int argc, char *argv[])
     return q_show(0);
 }
 
+/* Apply a journal record, mirroring the command that produced it */
+static bool journal_replay(const journal_rec_t *rec)
+{
+    if (rec->op != JOURNAL_NEW && rec->op != JOURNAL_LOAD) {
+        unsigned qid = rec->qid;
+        struct list_head *cur;
+        current = NULL;
+        list_for_each (cur, &chain.head) {
+            if (!qid--) {
+                current = list_entry(cur, queue_contex_t, chain);
+                break;
+            }
+        }
+        if (!current || !current->q)
+            return false;
+    }
+
+    struct list_head *q = current ? current->q : NULL;
+    switch (rec->op) {
+    case JOURNAL_NEW:
+        return chain_add(q_new(), 0)->q;
+    case JOURNAL_FREE: {
+        queue_contex_t *qnext = chain_next(current);
+        list_del(&current->chain);
+        q_free(q);
+        free(current);
+        chain.size--;
+        current = qnext;
+        return true;
+    }
+    case JOURNAL_IH:
+    case JOURNAL_IT:
+        /* The string is a NUL-terminated copy owned by the journal */
+        for (uint64_t r = 0; r < rec->arg; r++) {
+            char *str = (char *) rec->str;
+            if (!(rec->op == JOURNAL_IT ? q_insert_tail(q, str)
+                                        : q_insert_head(q, str)))
+                return false;
+            current->size++;
+        }
+        return true;
+    case JOURNAL_APPEND:
+        for (uint64_t r = 0; r < rec->arg; r++) {
+            if (!q_append_value(q, rec->str))
+                return false;
+        }
+        return true;
+    case JOURNAL_RH:
+    case JOURNAL_RT: {
+        element_t *re = rec->op == JOURNAL_RT ? q_remove_tail(q, NULL, 0)
+                                              : q_remove_head(q, NULL, 0);
+        if (!re)
+            return false;
+        q_release_element(re);
+        current->size--;
+        return true;
+    }
+    case JOURNAL_SORT:
+        q_sort(q, rec->arg);
+        return true;
+    case JOURNAL_REVERSE:
+        q_reverse(q);
+        return true;
+    case JOURNAL_REVERSEK:
+        q_reverseK(q, rec->arg);
+        return true;
+    case JOURNAL_SWAP:
+        q_swap(q);
+        return true;
+    case JOURNAL_DM:
+        if (!q_delete_mid(q))
+            return false;
+        current->size--;
+        return true;
+    case JOURNAL_DEDUP:
+        if (!q_delete_dup(q))
+            return false;
+        current->size = q_size(q);
+        return true;
+    case JOURNAL_ASCEND:
+        current->size = q_ascend(q);
+        return true;
+    case JOURNAL_DESCEND:
+        current->size = q_descend(q);
+        return true;
+    case JOURNAL_MERGE:
+        chain_merged(q_merge(&chain.head, rec->arg));
+        return true;
+    case JOURNAL_SHUFFLE:
+        return q_shuffle(q, rec->arg);
+    case JOURNAL_CLONE: {
+        struct list_head *copy = q_clone(q);
+        return copy && chain_add(copy, current->size);
+    }
+    case JOURNAL_LOAD: {
+        qfile_info_t info;
+        q = q_new();
+        long cnt = q ? qfile_load(rec->str, q, &info) : -1;
+        if (cnt < 0 || cnt != info.count) {
+            q_free(q);
+            return false;
+        }
+        chain_add(q, cnt);
+        return true;
+    }
+    default:
+        return false;
+    }
+}
+
+static void timer_changed(int oldval)
+{
+    if (!timer_mode)
+        exception_timer_stop();
+}
+
+static void malloc_seed_changed(int oldval)
+{
+    fail_reseed();
+}
+
 static void console_init()
 {
     ADD_COMMAND(new, "Create new queue", "");
     ADD_COMMAND(free, "Delete queue", "");
+    ADD_COMMAND(clone,
+                "Create new queue sharing the strings of current queue", "");
     ADD_COMMAND(prev, "Switch to previous queue", "");
     ADD_COMMAND(next, "Switch to next queue", "");
     ADD_COMMAND(ih,
@@ -1044,7 +2027,29 @@ static void console_init()
         "Remove from tail of queue. Optionally compare to expected value str",
         "[str]");
     ADD_COMMAND(reverse, "Reverse queue", "");
+    ADD_COMMAND(save, "Save current queue to file", "file");
+    ADD_COMMAND(load, "Load queue from file saved by 'save' as a new queue",
+                "file");
     ADD_COMMAND(sort, "Sort queue in ascending/descening order", "");
+    ADD_COMMAND(shuffle,
+                "Shuffle queue with Fisher-Yates algorithm. Use seed to "
+                "reproduce a permutation (default: random)",
+                "[seed]");
+    ADD_COMMAND(compact,
+                "Store strings of sorted queue front-coded until a command "
+                "needs its elements",
+                "");
+    ADD_COMMAND(append,
+                "Append str to the value of the last element n times "
+                "(default: n == 1)",
+                "str [n]");
+    ADD_COMMAND(find,
+                "Look up string str in queue n times (default: n == 1)",
+                "str [n]");
+    ADD_COMMAND(threads,
+                "Build, drain and free queues of n elements concurrently in "
+                "t threads, each freeing the queue of another",
+                "t n");
     ADD_COMMAND(size, "Compute queue size n times (default: n == 1)", "[n]");
     ADD_COMMAND(show, "Show queue contents", "");
     ADD_COMMAND(dm, "Delete middle node in queue", "");
@@ -1061,10 +2066,51 @@ static void console_init()
                 "");
     ADD_COMMAND(reverseK, "Reverse the nodes of the queue 'K' at a time",
                 "[K]");
+    ADD_COMMAND(perf,
+                "Show hardware counters per run of each command, or clear "
+                "them",
+                "[reset]");
+    ADD_COMMAND(memprof,
+                "Show allocations per call site and per command, or clear "
+                "their totals",
+                "[reset]");
+    set_cmd_hook(cmd_hook);
+    set_idle_hook(console_idle);
     add_param("length", &string_length, "Maximum length of displayed string",
               NULL);
     add_param("malloc", &fail_probability, "Malloc failure probability percent",
               NULL);
+    add_param("malloc_seed", &fail_seed,
+              "Seed of malloc failures, to reproduce them (0: random)",
+              malloc_seed_changed);
+    add_param("intern", &intern_mode,
+              "Share one copy of equal strings among queue elements", NULL);
+    add_param("lite", &lite_mode,
+              "Only count allocations, skipping the checks on blocks", NULL);
+    add_param("fill", &fill_mode,
+              "Fill allocated and freed blocks with a pattern", NULL);
+    add_param("guard", &guard_size,
+              "Place blocks of at least this size against a guard page "
+              "(0: never)",
+              NULL);
+    add_param("quarantine", &quarantine_limit,
+              "Number of freed blocks held back to catch use after free", NULL);
+    add_param("perf", &perf_mode,
+              "Count cycles, instructions, cache and branch misses of "
+              "commands",
+              perf_changed);
+    add_param("memprof", &memprof_mode,
+              "Record call site and command of each allocation", NULL);
+    add_param("timeout", &time_limit,
+              "Seconds allowed for each queue operation", NULL);
+    add_param("timer", &timer_mode,
+              "Time queue operations with one interval timer for the script",
+              timer_changed);
+    add_param("journal_batch", &journal_batch,
+              "Number of journal records made durable by one fsync", NULL);
+    add_param("journal_usec", &journal_usec,
+              "Microseconds a journal record may wait for fsync (0: no limit)",
+              NULL);
     add_param("fail", &fail_limit,
               "Number of times allow queue operations to return false", NULL);
     add_param("descend", &descend,
@@ -1078,6 +2124,7 @@ static void console_init()
 static void sigsegv_handler(int sig)
 {
     /* Avoid possible non-reentrant signal function be used in signal handler */
+    report_try_flush();
     assert(write(1,
                  "Segmentation fault occurred.  You dereferenced a NULL or "
                  "invalid pointer",
@@ -1088,6 +2135,12 @@ static void sigsegv_handler(int sig)
 
 static void sigalrm_handler(int sig)
 {
+    /* Jumping out of a report would leave the output locked */
+    if (report_defer_signal(sig))
+        return;
+    /* Ticks of the timer of timer mode also come between deadlines */
+    if (!exception_time_up())
+        return;
     trigger_exception(
         "Time limit exceeded.  Either you are in an infinite loop, or your "
         "code is too inefficient");
@@ -1103,6 +2156,8 @@ static void q_init()
 
 static bool q_quit(int argc, char *argv[])
 {
+    journal_close();
+
     report(3, "Freeing queue");
     if (current && current->size > BIG_LIST_SIZE)
         set_cautious_mode(false);
@@ -1113,12 +2168,14 @@ static bool q_quit(int argc, char *argv[])
             queue_contex_t *qctx = list_entry(cur, queue_contex_t, chain);
             cur = cur->next;
             q_free(qctx->q);
+            fcode_free(packed_of(qctx));
             free(qctx);
             chain.size--;
         }
     }
 
     exception_cancel();
+    exception_timer_stop();
     set_cautious_mode(true);
 
     size_t bcnt = allocation_check();
@@ -1133,11 +2190,14 @@ static bool q_quit(int argc, char *argv[])
 
 static void usage(char *cmd)
 {
-    printf("Usage: %s [-h] [-f IFILE][-v VLEVEL][-l LFILE]\n", cmd);
+    printf("Usage: %s [-h] [-f IFILE][-v VLEVEL][-l LFILE][-j JFILE][-e EFILE]\n",
+           cmd);
     printf("\t-h         Print this information\n");
     printf("\t-f IFILE   Read commands from IFILE\n");
     printf("\t-v VLEVEL  Set verbosity level\n");
     printf("\t-l LFILE   Echo results to LFILE\n");
+    printf("\t-j JFILE   Replay and extend journal of queue operations\n");
+    printf("\t-e EFILE   Log commands and events in binary to EFILE\n");
     exit(0);
 }
 
@@ -1205,10 +2265,14 @@ int main(int argc, char *argv[])
     char *infile_name = NULL;
     char lbuf[BUFSIZE];
     char *logfile_name = NULL;
+    char jbuf[BUFSIZE];
+    char *journal_name = NULL;
+    char ebuf[BUFSIZE];
+    char *evlog_name = NULL;
     int level = 4;
     int c;
 
-    while ((c = getopt(argc, argv, "hv:f:l:")) != -1) {
+    while ((c = getopt(argc, argv, "hv:f:l:j:e:")) != -1) {
         switch (c) {
         case 'h':
             usage(argv[0]);
@@ -1233,6 +2297,16 @@ int main(int argc, char *argv[])
             buf[BUFSIZE - 1] = '\0';
             logfile_name = lbuf;
             break;
+        case 'j':
+            strncpy(jbuf, optarg, BUFSIZE);
+            jbuf[BUFSIZE - 1] = '\0';
+            journal_name = jbuf;
+            break;
+        case 'e':
+            strncpy(ebuf, optarg, BUFSIZE);
+            ebuf[BUFSIZE - 1] = '\0';
+            evlog_name = ebuf;
+            break;
         default:
             printf("Unknown option '%c'\n", c);
             usage(argv[0]);
@@ -1263,9 +2337,27 @@ int main(int argc, char *argv[])
         set_echo(true);
     if (logfile_name)
         set_logfile(logfile_name);
+    if (evlog_name) {
+        if (!evlog_open(evlog_name)) {
+            fprintf(stderr, "Couldn't open event log '%s'\n", evlog_name);
+            return 1;
+        }
+        evlog_set_probe(evlog_probe);
+    }
 
     add_quit_helper(q_quit);
 
+    if (journal_name) {
+        size_t replayed;
+        if (!journal_open(journal_name, journal_replay, &replayed)) {
+            fprintf(stderr, "Couldn't replay journal '%s'\n", journal_name);
+            finish_cmd();
+            return 1;
+        }
+        report(1, "Replayed %lu operations from journal '%s'", replayed,
+               journal_name);
+    }
+
     bool ok = true;
     ok = ok && run_console(infile_name);
 
@@ -2,7 +2,9 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "qindex.h"
 #include "queue.h"
+#include "random.h"
 
 /* Notice: sometimes, Cppcheck would find the potential NULL pointer bugs,
  * but some of them cannot occur. You can suppress them by adding the
@@ -14,15 +16,46 @@ typedef int (*list_cmp_func_t)(void *,
                                const struct list_head *,
                                const struct list_head *);
 
+/* Queue header, carrying the membership index once q_contains needs one.
+ * Operations that cannot allocate mark the index stale instead of updating
+ * it, and the next lookup rebuilds it.
+ */
+typedef struct {
+    struct list_head head;
+    qindex_t *index;
+    bool stale;
+} queue_head_t;
+
+static inline queue_head_t *queue_of(struct list_head *head)
+{
+    return container_of(head, queue_head_t, head);
+}
+
+static void index_add(struct list_head *head, element_t *e)
+{
+    queue_head_t *q = queue_of(head);
+    if (q->index && !q->stale && !qindex_add(q->index, e))
+        q->stale = true;
+}
+
+static void index_del(struct list_head *head, element_t *e)
+{
+    queue_head_t *q = queue_of(head);
+    if (q->index && !q->stale && !qindex_del(q->index, e))
+        q->stale = true;
+}
+
 /* Create an empty queue */
 struct list_head *q_new()
 {
-    struct list_head *head = malloc(sizeof(struct list_head));
-    if (!head)
+    queue_head_t *q = malloc(sizeof(queue_head_t));
+    if (!q)
         return NULL;
 
-    INIT_LIST_HEAD(head);
-    return head;
+    INIT_LIST_HEAD(&q->head);
+    q->index = NULL;
+    q->stale = false;
+    return &q->head;
 }
 
 /* Free all storage used by queue */
@@ -35,7 +68,38 @@ void q_free(struct list_head *head)
     list_for_each_entry_safe (curr, tmp, head, list) {
         q_release_element(curr);
     }
-    free(head);
+    qindex_free(queue_of(head)->index);
+    free(queue_of(head));
+}
+
+/* Create a copy of queue sharing the storage of its strings */
+struct list_head *q_clone(struct list_head *head)
+{
+    if (!head)
+        return NULL;
+
+    struct list_head *copy = q_new();
+    if (!copy)
+        return NULL;
+
+    element_t *curr = NULL;
+    list_for_each_entry (curr, head, list) {
+        element_t *new_element = malloc(sizeof(element_t));
+        if (!new_element)
+            goto fail;
+
+        new_element->value = strpool_share(&curr->value);
+        if (!new_element->value) {
+            free(new_element);
+            goto fail;
+        }
+        list_add_tail(&new_element->list, copy);
+    }
+    return copy;
+
+fail:
+    q_free(copy);
+    return NULL;
 }
 
 /* Insert an element at head of queue */
@@ -48,13 +112,14 @@ bool q_insert_head(struct list_head *head, char *s)
     if (!new_element)
         return false;
 
-    new_element->value = strdup(s);
+    new_element->value = strpool_dup(s);
     if (!new_element->value) {
         free(new_element);
         return false;
     }
 
     list_add(&new_element->list, head);
+    index_add(head, new_element);
     return true;
 }
 
@@ -68,13 +133,14 @@ bool q_insert_tail(struct list_head *head, char *s)
     if (!new_element)
         return false;
 
-    new_element->value = strdup(s);
+    new_element->value = strpool_dup(s);
     if (!new_element->value) {
         free(new_element);
         return false;
     }
 
     list_add_tail(&new_element->list, head);
+    index_add(head, new_element);
     return true;
 }
 
@@ -93,6 +159,7 @@ element_t *q_remove_head(struct list_head *head, char *sp, size_t bufsize)
     }
 
     list_del(&target->list);
+    index_del(head, target);
     return target;
 }
 
@@ -110,6 +177,7 @@ element_t *q_remove_tail(struct list_head *head, char *sp, size_t bufsize)
         sp[copy_len] = '\0';
     }
     list_del(&target->list);
+    index_del(head, target);
     return target;
 }
 
@@ -139,20 +207,27 @@ bool q_delete_mid(struct list_head *head)
     }
     element_t *del = list_entry(currNext, element_t, list);
     list_del(&del->list);
-    free(del->value);
-    free(del);
+    index_del(head, del);
+    q_release_element(del);
     return true;
 }
 
-static void q_delete_dup_free_helper(struct list_head *del)
+static void q_delete_dup_free_helper(struct list_head *head,
+                                     struct list_head *del)
 {
     if (!del)
         return;
 
     element_t *del_e = list_entry(del, element_t, list);
     list_del_init(&del_e->list);
-    free(del_e->value);
-    free(del_e);
+    index_del(head, del_e);
+    q_release_element(del_e);
+}
+
+/* Interned values share storage, so equal addresses imply equal strings */
+static inline bool value_equal(const char *a, const char *b)
+{
+    return a == b || !strcmp(a, b);
 }
 
 /* Delete all nodes that have duplicate string */
@@ -170,21 +245,21 @@ bool q_delete_dup(struct list_head *head)
     while (*indir != head && (*indir)->next != head) {
         e = list_entry(*indir, element_t, list);
         next_e = list_entry((*indir)->next, element_t, list);
-        if (!strcmp(e->value, next_e->value)) {
+        if (value_equal(e->value, next_e->value)) {
             while (*indir != head && (*indir)->next != head) {
                 e = list_entry(*indir, element_t, list);
                 next_e = list_entry((*indir)->next, element_t, list);
-                if (!strcmp(e->value, next_e->value)) {
+                if (value_equal(e->value, next_e->value)) {
                     del = *indir;
                     *indir = (*indir)->next;
-                    q_delete_dup_free_helper(del);
+                    q_delete_dup_free_helper(head, del);
                     del = *indir;
                 } else {
                     *indir = (*indir)->next;
                     break;
                 }
             }
-            q_delete_dup_free_helper(del);
+            q_delete_dup_free_helper(head, del);
             del = NULL;
         } else
             indir = &(*indir)->next;
@@ -217,26 +292,163 @@ void q_reverse(struct list_head *head)
     }
 }
 
+/* Reverse at most k nodes following prev in place.
+ * Return the number of nodes reversed.
+ */
+static int reverse_group(struct list_head *prev, struct list_head *head, int k)
+{
+    struct list_head *first = prev->next, *curr = first, *nxt = NULL;
+    int n = 0;
+    while (n < k && curr != head) {
+        nxt = curr->next;
+        curr->next = curr->prev;
+        curr->prev = nxt;
+        curr = nxt;
+        n++;
+    }
+
+    /* curr follows the group and still points back to its old last node */
+    struct list_head *last = curr->prev;
+    first->next = curr;
+    curr->prev = first;
+    last->prev = prev;
+    prev->next = last;
+    return n;
+}
+
 /* Reverse the nodes of the list k at a time */
 void q_reverseK(struct list_head *head, int k)
 {
-    if (!head || list_empty(head))
+    if (!head || list_empty(head) || k < 2)
         return;
 
-    int count = 1;
-    struct list_head *curr = head->next, *prev = head, *nxt = curr->next;
-    LIST_HEAD(tmp_list);
-    while (curr != head) {
-        if (count % k == 0) {
-            list_cut_position(&tmp_list, prev, curr);
-            q_reverse(&tmp_list);
-            list_splice_init(&tmp_list, prev);
-            prev = nxt->prev;
+    struct list_head *prev = head;
+    while (prev->next != head) {
+        struct list_head *first = prev->next;
+        if (reverse_group(prev, head, k) < k) {
+            /* Fewer than k nodes were left, so restore their order */
+            reverse_group(prev, head, k);
+            break;
         }
-        count++;
-        curr = nxt;
-        nxt = nxt->next;
+        prev = first;
+    }
+}
+
+/* Distance, in nodes, of prefetches issued while shuffling */
+#define SHUFFLE_PREFETCH 16
+
+/* Collect the nodes of queue into an array, setting *np to their number */
+static struct list_head **gather_nodes(struct list_head *head, size_t *np)
+{
+    size_t n = 0, cap = 1024;
+    struct list_head **nodes = malloc(cap * sizeof(struct list_head *));
+    if (!nodes)
+        return NULL;
+
+    struct list_head *curr = NULL;
+    list_for_each (curr, head) {
+        if (n == cap) {
+            struct list_head **grown =
+                malloc(2 * cap * sizeof(struct list_head *));
+            if (!grown) {
+                free(nodes);
+                return NULL;
+            }
+            memcpy(grown, nodes, cap * sizeof(struct list_head *));
+            free(nodes);
+            nodes = grown;
+            cap *= 2;
+        }
+        nodes[n++] = curr;
+    }
+    *np = n;
+    return nodes;
+}
+
+/* Check whether a string is stored in queue */
+bool q_contains(struct list_head *head, const char *s)
+{
+    if (!head || !s)
+        return false;
+
+    queue_head_t *q = queue_of(head);
+    if (!q->index || q->stale) {
+        qindex_free(q->index);
+        q->index = qindex_new(head);
+        q->stale = false;
+    }
+    if (q->index)
+        return qindex_contains(q->index, s);
+
+    /* Without memory for an index, fall back to a walk */
+    element_t *e;
+    list_for_each_entry (e, head, list) {
+        if (value_equal(e->value, s))
+            return true;
     }
+    return false;
+}
+
+/* Append s to the value of the last element */
+bool q_append_value(struct list_head *head, const char *s)
+{
+    if (!head || list_empty(head) || !s)
+        return false;
+
+    element_t *e = list_last_entry(head, element_t, list);
+    /* The index locates the element by the hash of its value */
+    index_del(head, e);
+    bool ok = strpool_append(&e->value, s) != NULL;
+    index_add(head, e);
+    return ok;
+}
+
+/* Rearrange elements in queue into a uniformly random order */
+bool q_shuffle(struct list_head *head, uintptr_t seed)
+{
+    if (!head)
+        return false;
+    if (list_empty(head) || list_is_singular(head))
+        return true;
+
+    size_t n;
+    struct list_head **nodes = gather_nodes(head, &n);
+    if (!nodes)
+        return false;
+
+    /* Fisher-Yates over a SplitMix generator: a Weyl sequence whose
+     * successive states are scrambled by random_shuffle().  Each index is
+     * drawn one step ahead, so its slot can be prefetched.
+     */
+    uintptr_t state = seed + (uintptr_t) 0x9e3779b97f4a7c15ULL;
+    size_t j = random_shuffle(state) % n;
+    for (size_t i = n - 1; i > 0; i--) {
+        size_t next_j = 0;
+        if (i > 1) {
+            state += (uintptr_t) 0x9e3779b97f4a7c15ULL;
+            next_j = random_shuffle(state) % i;
+            __builtin_prefetch(&nodes[next_j], 1);
+        }
+        struct list_head *tmp = nodes[i];
+        nodes[i] = nodes[j];
+        nodes[j] = tmp;
+        j = next_j;
+    }
+
+    /* Relink in one pass; the nodes are scattered, so fetch them early */
+    struct list_head *prev = head;
+    for (size_t i = 0; i < n; i++) {
+        if (i + SHUFFLE_PREFETCH < n)
+            __builtin_prefetch(nodes[i + SHUFFLE_PREFETCH], 1);
+        prev->next = nodes[i];
+        nodes[i]->prev = prev;
+        prev = nodes[i];
+    }
+    prev->next = head;
+    head->prev = prev;
+
+    free(nodes);
+    return true;
 }
 
 static void merge(struct list_head *head,
@@ -305,8 +517,8 @@ int q_ascend(struct list_head *head)
             last_e = list_last_entry(&descend_list, element_t, list);
             if (strcmp(curr_e->value, last_e->value) < 0) {
                 list_del_init(&last_e->list);
-                free(last_e->value);
-                free(last_e);
+                index_del(head, last_e);
+                q_release_element(last_e);
             } else
                 break;
         }
@@ -332,8 +544,8 @@ int q_descend(struct list_head *head)
             last_e = list_last_entry(&descend_list, element_t, list);
             if (strcmp(curr_e->value, last_e->value) > 0) {
                 list_del_init(&last_e->list);
-                free(last_e->value);
-                free(last_e);
+                index_del(head, last_e);
+                q_release_element(last_e);
             } else
                 break;
         }
@@ -353,6 +565,8 @@ int q_merge(struct list_head *head, bool descend)
     queue_contex_t *qc_first = list_first_entry(head, queue_contex_t, chain);
     queue_contex_t *curr = NULL;
     list_for_each_entry (curr, head, chain) {
+        /* Merging must not allocate, so leave indexes to be rebuilt */
+        queue_of(curr->q)->stale = true;
         if (qc_first == curr)
             continue;
         list_splice_init(curr->q, qc_first->q);
@@ -9,16 +9,19 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 #include "harness.h"
 #include "list.h"
+#include "strpool.h"
 
 /**
  * element_t - Linked list element
  * @value: pointer to array holding string
  * @list: node of a doubly-linked list
  *
- * @value needs to be explicitly allocated and freed
+ * @value needs to be explicitly allocated and freed, through strpool_dup()
+ * and strpool_release() when it may be shared with other elements
  */
 typedef struct {
     char *value;
@@ -54,6 +57,18 @@ struct list_head *q_new();
  */
 void q_free(struct list_head *head);
 
+/**
+ * q_clone() - Create a copy of the queue, sharing storage of its strings
+ * @head: header of queue
+ *
+ * Every element gets a new node, but its string is shared by reference with
+ * the original rather than copied.  Shared strings are never modified in
+ * place, so either queue can be changed without affecting the other.
+ *
+ * Return: the new queue, NULL for allocation failed or queue is NULL
+ */
+struct list_head *q_clone(struct list_head *head);
+
 /**
  * q_insert_head() - Insert an element in the head
  * @head: header of queue
@@ -116,7 +131,7 @@ element_t *q_remove_tail(struct list_head *head, char *sp, size_t bufsize);
  */
 static inline void q_release_element(element_t *e)
 {
-    test_free(e->value);
+    strpool_release(e->value);
     test_free(e);
 }
 
@@ -190,6 +205,48 @@ void q_reverse(struct list_head *head);
  */
 void q_reverseK(struct list_head *head, int k);
 
+/**
+ * q_contains() - Check whether a string is stored in queue
+ * @head: header of queue
+ * @s: string to look for
+ *
+ * The first call builds a hash index of the queue, which later insertions
+ * and removals keep up to date, so further calls take constant time.
+ *
+ * Return: true if an element holds a string equal to s, false otherwise or
+ * if queue is NULL
+ */
+bool q_contains(struct list_head *head, const char *s);
+
+/**
+ * q_append_value() - Append a string to the value of the last element
+ * @head: header of queue
+ * @s: string to append
+ *
+ * The value is grown in place when the allocator allows it, rather than
+ * copied to a new string.
+ *
+ * Return: true for success, false if queue is NULL or empty, or allocation
+ * failed, in which case the value is left unchanged
+ */
+bool q_append_value(struct list_head *head, const char *s);
+
+/**
+ * q_shuffle() - Rearrange elements in queue into a uniformly random order
+ * @head: header of queue
+ * @seed: initial state of the pseudo-random number generator
+ *
+ * Use the Fisher-Yates algorithm, so every permutation is equally likely.
+ * The same seed always yields the same permutation of a given queue.
+ * No effect if queue is NULL or empty.
+ *
+ * Reference:
+ * https://en.wikipedia.org/wiki/Fisher%E2%80%93Yates_shuffle
+ *
+ * Return: true for success, false for allocation failed or queue is NULL
+ */
+bool q_shuffle(struct list_head *head, uintptr_t seed);
+
 /**
  * q_sort() - Sort elements of queue in ascending/descending order
  * @head: header of queue
@@ -1,3 +1,9 @@
+/* PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP is a GNU extension */
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdarg.h>
 #include <stdbool.h>
@@ -9,32 +15,141 @@
 #include <time.h>
 #include <unistd.h>
 
+#include "evlog.h"
 #include "report.h"
 #include "web.h"
 
-#define MAX(a, b) ((a) < (b) ? (b) : (a))
+/* Output is collected in memory and written with a single write(2) at flush
+ * points: when a buffer fills, before blocking on input, on fatal errors,
+ * and at exit.  Messages are formatted once, straight into the buffer.
+ */
+#define OUT_SIZE (64 * 1024)
+
+typedef struct {
+    int fd;
+    size_t len;
+    char buf[OUT_SIZE];
+} outbuf_t;
+
+static outbuf_t verb_out = {.fd = STDOUT_FILENO};
+static outbuf_t log_out = {.fd = -1};
+
+/* Other systems spell it without the suffix */
+#ifndef PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP
+#define PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP PTHREAD_RECURSIVE_MUTEX_INITIALIZER
+#endif
 
-static FILE *errfile = NULL;
-static FILE *verbfile = NULL;
-static FILE *logfile = NULL;
+/* Recursive, so that a fatal signal raised while reporting can still flush */
+static pthread_mutex_t out_lock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+
+/* A handler jumping out of code holding out_lock would leave it held for
+ * good.  out_depth counts how many times the thread holds it, and signals
+ * passed to report_defer_signal meanwhile are raised again on release.
+ */
+static __thread volatile sig_atomic_t out_depth = 0;
+static __thread volatile sig_atomic_t out_deferred = 0;
 
 int verblevel = 0;
-static void init_files(FILE *efile, FILE *vfile)
+
+static void out_acquire()
 {
-    errfile = efile;
-    verbfile = vfile;
+    pthread_mutex_lock(&out_lock);
+    out_depth++;
 }
 
-static char fail_buf[1024] = "FATAL Error.  Exiting\n";
+static void out_release()
+{
+    /* A signal coming after the unlock is still deferred, and raised here */
+    pthread_mutex_unlock(&out_lock);
+    if (!--out_depth && out_deferred) {
+        int sig = out_deferred;
+        out_deferred = 0;
+        raise(sig);
+    }
+}
+
+bool report_defer_signal(int sig)
+{
+    if (!out_depth)
+        return false;
+    out_deferred = sig;
+    return true;
+}
+
+static void out_write(int fd, const char *s, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = write(fd, s, len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+        s += n;
+        len -= n;
+    }
+}
+
+static void out_drain(outbuf_t *o)
+{
+    if (o->len > 0 && o->fd >= 0)
+        out_write(o->fd, o->buf, o->len);
+    o->len = 0;
+}
+
+static void out_append(outbuf_t *o, const char *s, size_t len)
+{
+    if (o->fd < 0)
+        return;
+    if (o->len + len > OUT_SIZE) {
+        out_drain(o);
+        if (len > OUT_SIZE) {
+            out_write(o->fd, s, len);
+            return;
+        }
+    }
+    memcpy(o->buf + o->len, s, len);
+    o->len += len;
+}
 
-static volatile int ret = 0;
+void report_flush()
+{
+    out_acquire();
+    out_drain(&verb_out);
+    out_drain(&log_out);
+    out_release();
+}
+
+bool report_try_flush()
+{
+    if (pthread_mutex_trylock(&out_lock))
+        return false;
+    out_drain(&verb_out);
+    out_drain(&log_out);
+    pthread_mutex_unlock(&out_lock);
+    return true;
+}
+
+static void init_output()
+{
+    static bool registered = false;
+    if (!registered) {
+        atexit(report_flush);
+        registered = true;
+    }
+}
+
+static char fail_buf[1024] = "FATAL Error.  Exiting\n";
 
 /* Default fatal function */
 static void default_fatal_fun()
 {
-    ret = write(STDOUT_FILENO, fail_buf, strlen(fail_buf) + 1);
-    if (logfile)
-        fputs(fail_buf, logfile);
+    out_acquire();
+    out_drain(&verb_out);
+    out_write(STDOUT_FILENO, fail_buf, strlen(fail_buf) + 1);
+    out_append(&log_out, fail_buf, strlen(fail_buf));
+    out_drain(&log_out);
+    out_release();
 }
 
 /* Optional function to call when fatal error encountered */
@@ -47,10 +162,15 @@ void set_verblevel(int level)
 
 bool set_logfile(const char *file_name)
 {
-    logfile = fopen(file_name, "w");
-    return logfile != NULL;
+    report_flush();
+    if (log_out.fd >= 0)
+        close(log_out.fd);
+    log_out.fd = open(file_name, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    return log_out.fd >= 0;
 }
 
+#define BUF_SIZE 4096
+
 void report_event(message_t msg, char *fmt, ...)
 {
     va_list ap;
@@ -65,97 +185,114 @@ void report_event(message_t msg, char *fmt, ...)
     if (msg < N_MSG)
         msg_name = msg_name_text[msg];
     int level = N_MSG - msg - 1;
-    if (verblevel < level)
+    bool logged = evlog_is_open();
+    if (verblevel < level && !logged)
         return;
 
-    if (!errfile)
-        init_files(stdout, stdout);
+    init_output();
 
+    char buffer[BUF_SIZE];
     va_start(ap, fmt);
-    fprintf(errfile, "%s: ", msg_name);
-    vfprintf(errfile, fmt, ap);
-    fprintf(errfile, "\n");
-    fflush(errfile);
+    int len = vsnprintf(buffer, BUF_SIZE, fmt, ap);
     va_end(ap);
+    if (len < 0)
+        len = 0;
+    else if (len >= BUF_SIZE)
+        len = BUF_SIZE - 1;
+
+    /* Events are logged whatever the verbosity */
+    if (logged)
+        evlog_event(msg, buffer, len);
+    if (verblevel < level)
+        return;
 
-    if (logfile) {
-        va_start(ap, fmt);
-        fprintf(logfile, "Error: ");
-        vfprintf(logfile, fmt, ap);
-        fprintf(logfile, "\n");
-        fflush(logfile);
-        va_end(ap);
-        fclose(logfile);
-    }
+    out_acquire();
+    out_append(&verb_out, msg_name, strlen(msg_name));
+    out_append(&verb_out, ": ", 2);
+    out_append(&verb_out, buffer, len);
+    out_append(&verb_out, "\n", 1);
+    out_append(&log_out, "Error: ", 7);
+    out_append(&log_out, buffer, len);
+    out_append(&log_out, "\n", 1);
+    out_release();
 
     if (fatal) {
+        report_flush();
         if (fatal_fun)
             fatal_fun();
         exit(1);
     }
 }
 
-#define BUF_SIZE 4096
 extern int web_connfd;
-void report(int level, char *fmt, ...)
-{
-    if (!verbfile)
-        init_files(stdout, stdout);
 
-    char buffer[BUF_SIZE];
-    if (level <= verblevel) {
-        va_list ap;
-        va_start(ap, fmt);
-        vfprintf(verbfile, fmt, ap);
-        fprintf(verbfile, "\n");
-        fflush(verbfile);
-        va_end(ap);
-
-        if (logfile) {
-            va_start(ap, fmt);
-            vfprintf(logfile, fmt, ap);
-            fprintf(logfile, "\n");
-            fflush(logfile);
-            va_end(ap);
+/* Format a message into the verbose buffer, copy it to the log and to the web
+ * connection, if any.
+ */
+static void report_vprint(const char *fmt, va_list ap, bool newline)
+{
+    init_output();
+
+    out_acquire();
+    outbuf_t *o = &verb_out;
+    char *msg, *big = NULL;
+    va_list aq;
+    va_copy(aq, ap);
+    size_t room = OUT_SIZE - o->len;
+    int n = vsnprintf(o->buf + o->len, room, fmt, ap);
+    if (n < 0)
+        goto out;
+    msg = o->buf + o->len;
+    /* Leave space for the newline and the terminator */
+    if ((size_t) n + 2 > room) {
+        out_drain(o);
+        msg = o->buf;
+        if ((size_t) n + 2 > OUT_SIZE) {
+            big = malloc(n + 2);
+            if (!big)
+                goto out;
+            msg = big;
         }
-        va_start(ap, fmt);
-        vsnprintf(buffer, BUF_SIZE, fmt, ap);
-        va_end(ap);
+        vsnprintf(msg, n + 1, fmt, aq);
     }
-    if (web_connfd) {
-        int len = strlen(buffer);
-        buffer[len] = '\n';
-        buffer[len + 1] = '\0';
-        web_send(web_connfd, buffer);
+    if (newline) {
+        msg[n++] = '\n';
+        msg[n] = '\0';
     }
+
+    if (big)
+        out_write(o->fd, big, n);
+    else
+        o->len += n;
+    out_append(&log_out, msg, n);
+    if (web_connfd)
+        web_send(web_connfd, msg);
+    free(big);
+out:
+    va_end(aq);
+    out_release();
 }
 
-void report_noreturn(int level, char *fmt, ...)
+void report(int level, char *fmt, ...)
 {
-    if (!verbfile)
-        init_files(stdout, stdout);
+    if (level > verblevel)
+        return;
 
-    char buffer[BUF_SIZE];
-    if (level <= verblevel) {
-        va_list ap;
-        va_start(ap, fmt);
-        vfprintf(verbfile, fmt, ap);
-        fflush(verbfile);
-        va_end(ap);
-
-        if (logfile) {
-            va_start(ap, fmt);
-            vfprintf(logfile, fmt, ap);
-            fflush(logfile);
-            va_end(ap);
-        }
-        va_start(ap, fmt);
-        vsnprintf(buffer, BUF_SIZE, fmt, ap);
-        va_end(ap);
-    }
+    va_list ap;
+    va_start(ap, fmt);
+    report_vprint(fmt, ap, true);
+    va_end(ap);
+}
 
-    if (web_connfd)
-        web_send(web_connfd, buffer);
+void report_noreturn(int level, char *fmt, ...)
+{
+    if (level > verblevel)
+        return;
+
+    va_list ap;
+    va_start(ap, fmt);
+    report_vprint(fmt, ap, false);
+    va_end(ap);
 }
 
 /* Functions denoting failures */
@@ -166,42 +303,169 @@ static void fail_fun(const char *format, const char *msg)
     snprintf(fail_buf, sizeof(fail_buf), format, msg);
     /* Tack on return */
     fail_buf[strlen(fail_buf)] = '\n';
-    /* Use write to avoid any buffering issues */
-    ret = write(STDOUT_FILENO, fail_buf, strlen(fail_buf) + 1);
-
-    if (logfile) {
-        /* Don't know file descriptor for logfile */
-        fputs(fail_buf, logfile);
-    }
+    /* Write pending output first, then the message, unbuffered */
+    out_acquire();
+    out_drain(&verb_out);
+    out_write(STDOUT_FILENO, fail_buf, strlen(fail_buf) + 1);
+    out_append(&log_out, fail_buf, strlen(fail_buf));
+    out_release();
 
     if (fatal_fun)
         fatal_fun();
 
-    if (logfile)
-        fclose(logfile);
-
+    report_flush();
     exit(1);
 }
 
 /* Maximum number of megabytes that application can use (0 = unlimited) */
 static int mblimit = 0;
 
-/* Keeping track of memory allocation */
-static size_t allocate_cnt = 0;
-static size_t allocate_bytes = 0;
-static size_t free_cnt = 0;
-static size_t free_bytes = 0;
+/* Memory allocated through the functions below and through the test
+ * harness, counted by each thread in its own block so that the counts cost
+ * no atomic operations, and summed when read.  A thread exiting adds its
+ * counts to mem_exited and frees its block.  Net bytes of a thread go
+ * negative when it frees the memory of others, and peaks only follow the
+ * memory allocated by the thread itself.
+ */
+typedef struct mem_thread {
+    size_t allocs, frees;
+    size_t alloc_bytes, free_bytes;
+    int64_t peak;   /* Highest net bytes */
+    int64_t window; /* Highest net bytes since mem_peak_mark */
+    struct mem_thread *next;
+} mem_thread_t;
+
+static mem_thread_t *mem_threads = NULL;
+static mem_thread_t mem_exited; /* Counts of the threads gone */
+static pthread_mutex_t mem_threads_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread mem_thread_t *mem_local = NULL;
+
+/* Key whose destructor retires the block of an exiting thread */
+static pthread_key_t mem_key;
+static pthread_once_t mem_key_once = PTHREAD_ONCE_INIT;
+
+static void mem_thread_exit(void *p)
+{
+    mem_thread_t *t = p;
+    pthread_mutex_lock(&mem_threads_lock);
+    mem_thread_t **tp = &mem_threads;
+    while (*tp != t)
+        tp = &(*tp)->next;
+    *tp = t->next;
+    mem_exited.allocs += t->allocs;
+    mem_exited.frees += t->frees;
+    mem_exited.alloc_bytes += t->alloc_bytes;
+    mem_exited.free_bytes += t->free_bytes;
+    if (t->peak > mem_exited.peak)
+        mem_exited.peak = t->peak;
+    pthread_mutex_unlock(&mem_threads_lock);
+    free(t);
+    mem_local = NULL;
+}
+
+static void mem_key_create()
+{
+    pthread_key_create(&mem_key, mem_thread_exit);
+}
+
+static mem_thread_t *mem_thread()
+{
+    if (__builtin_expect(mem_local != NULL, 1))
+        return mem_local;
+
+    mem_thread_t *t = calloc(1, sizeof(mem_thread_t));
+    if (!t)
+        fail_fun("Calloc returned NULL in %s", "mem_thread");
+    pthread_once(&mem_key_once, mem_key_create);
+    pthread_setspecific(mem_key, t);
+    pthread_mutex_lock(&mem_threads_lock);
+    t->next = mem_threads;
+    mem_threads = t;
+    pthread_mutex_unlock(&mem_threads_lock);
+    return mem_local = t;
+}
 
-/* Counters giving peak memory usage */
-static size_t peak_bytes = 0;
-static size_t last_peak_bytes = 0;
-static size_t current_bytes = 0;
+/* Only the owner writes the counters of a block; stores and loads are atomic
+ * so others may read them
+ */
+#define MEM_ADD(field, n) \
+    __atomic_store_n(&(field), (field) + (n), __ATOMIC_RELAXED)
+#define MEM_LOAD(field) __atomic_load_n(&(field), __ATOMIC_RELAXED)
+
+static int64_t mem_net(const mem_thread_t *t)
+{
+    return (int64_t) (t->alloc_bytes - t->free_bytes);
+}
+
+void mem_count_alloc(size_t bytes)
+{
+    mem_thread_t *t = mem_thread();
+    MEM_ADD(t->allocs, 1);
+    MEM_ADD(t->alloc_bytes, bytes);
+    int64_t net = mem_net(t);
+    if (net > t->window)
+        t->window = net;
+    if (net > t->peak)
+        __atomic_store_n(&t->peak, net, __ATOMIC_RELAXED);
+}
+
+void mem_count_free(size_t bytes)
+{
+    mem_thread_t *t = mem_thread();
+    MEM_ADD(t->frees, 1);
+    MEM_ADD(t->free_bytes, bytes);
+}
+
+void mem_counts(mem_counts_t *m)
+{
+    pthread_mutex_lock(&mem_threads_lock);
+    m->allocs = mem_exited.allocs;
+    m->frees = mem_exited.frees;
+    m->alloc_bytes = mem_exited.alloc_bytes;
+    m->free_bytes = mem_exited.free_bytes;
+    int64_t peak = mem_exited.peak;
+    for (mem_thread_t *t = mem_threads; t; t = t->next) {
+        m->allocs += MEM_LOAD(t->allocs);
+        m->frees += MEM_LOAD(t->frees);
+        m->alloc_bytes += MEM_LOAD(t->alloc_bytes);
+        m->free_bytes += MEM_LOAD(t->free_bytes);
+        int64_t p = MEM_LOAD(t->peak);
+        if (p > peak)
+            peak = p;
+    }
+    pthread_mutex_unlock(&mem_threads_lock);
+    m->current_bytes = m->alloc_bytes - m->free_bytes;
+    m->peak_bytes = peak;
+}
+
+mem_mark_t mem_peak_mark()
+{
+    mem_thread_t *t = mem_thread();
+    mem_mark_t mark = {.base = mem_net(t), .window = t->window};
+    t->window = mark.base;
+    return mark;
+}
+
+size_t mem_peak_rise(mem_mark_t mark)
+{
+    mem_thread_t *t = mem_thread();
+    int64_t peak = t->window;
+    /* An enclosing span keeps its own peak */
+    if (mark.window > t->window)
+        t->window = mark.window;
+    return peak > mark.base ? peak - mark.base : 0;
+}
 
 static void check_exceed(size_t new_bytes)
 {
+    if (mblimit <= 0)
+        return;
+
     size_t limit_bytes = (size_t) mblimit << 20;
-    size_t request_bytes = new_bytes + current_bytes;
-    if (mblimit > 0 && request_bytes > limit_bytes) {
+    mem_counts_t m;
+    mem_counts(&m);
+    size_t request_bytes = new_bytes + m.current_bytes;
+    if (request_bytes > limit_bytes) {
         report_event(MSG_FATAL,
                      "Exceeded memory limit of %u megabytes with %lu bytes",
                      mblimit, request_bytes);
@@ -218,12 +482,7 @@ void *malloc_or_fail(size_t bytes, const char *fun_name)
         return NULL;
     }
 
-    allocate_cnt++;
-    allocate_bytes += bytes;
-    current_bytes += bytes;
-    peak_bytes = MAX(peak_bytes, current_bytes);
-    last_peak_bytes = MAX(last_peak_bytes, current_bytes);
-
+    mem_count_alloc(bytes);
     return p;
 }
 
@@ -237,12 +496,7 @@ void *calloc_or_fail(size_t cnt, size_t bytes, const char *fun_name)
         return NULL;
     }
 
-    allocate_cnt++;
-    allocate_bytes += cnt * bytes;
-    current_bytes += cnt * bytes;
-    peak_bytes = MAX(peak_bytes, current_bytes);
-    last_peak_bytes = MAX(last_peak_bytes, current_bytes);
-
+    mem_count_alloc(cnt * bytes);
     return p;
 }
 
@@ -257,12 +511,7 @@ char *strsave_or_fail(const char *s, const char *fun_name)
     if (!ss)
         fail_fun("strsave failed in %s", fun_name);
 
-    allocate_cnt++;
-    allocate_bytes += len + 1;
-    current_bytes += len + 1;
-    peak_bytes = MAX(peak_bytes, current_bytes);
-    last_peak_bytes = MAX(last_peak_bytes, current_bytes);
-
+    mem_count_alloc(len + 1);
     return strncpy(ss, s, len + 1);
 }
 
@@ -272,10 +521,7 @@ void free_block(void *b, size_t bytes)
     if (!b)
         report_event(MSG_ERROR, "Attempting to free null block");
     free(b);
-
-    free_cnt++;
-    free_bytes += bytes;
-    current_bytes -= bytes;
+    mem_count_free(bytes);
 }
 
 /* Free array, as from calloc */
@@ -284,10 +530,7 @@ void free_array(void *b, size_t cnt, size_t bytes)
     if (!b)
         report_event(MSG_ERROR, "Attempting to free null block");
     free(b);
-
-    free_cnt++;
-    free_bytes += cnt * bytes;
-    current_bytes -= cnt * bytes;
+    mem_count_free(cnt * bytes);
 }
 
 /* Free string saved by strsave_or_fail */
@@ -306,9 +549,9 @@ void init_time(double *timep)
 
 double delta_time(double *timep)
 {
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    double current_time = tv.tv_sec + 1.0E-6 * tv.tv_usec;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    double current_time = ts.tv_sec + 1.0E-9 * ts.tv_nsec;
     double delta = current_time - *timep;
     *timep = current_time;
     return delta;
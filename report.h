@@ -3,6 +3,8 @@
 
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
 /* Ways to report interesting behavior and errors */
 
@@ -26,6 +28,20 @@ void report(int verblevel, char *fmt, ...);
 /* Like report, but without return character */
 void report_noreturn(int verblevel, char *fmt, ...);
 
+/* Write out buffered output.  Call before blocking or writing directly */
+void report_flush();
+
+/* Like report_flush, but give up rather than wait for another thread
+ * holding the output, as a handler of a fatal signal must.  Return whether
+ * the output was written.
+ */
+bool report_try_flush();
+
+/* For a handler that may jump away: if the interrupted code holds the
+ * output, keep sig to be raised again once it is released, and return true
+ */
+bool report_defer_signal(int sig);
+
 /* Attempt to call malloc.  Fail when returns NULL */
 void *malloc_or_fail(size_t bytes, const char *fun_name);
 
@@ -44,6 +60,31 @@ void free_array(void *b, size_t cnt, size_t bytes);
 /* Free string saved by strsave_or_fail */
 void free_string(char *s);
 
+/* Memory allocated through the functions above and the test harness */
+typedef struct {
+    size_t allocs, frees;
+    size_t alloc_bytes, free_bytes;
+    size_t current_bytes, peak_bytes;
+} mem_counts_t;
+
+/* Count an allocation or a release of bytes */
+void mem_count_alloc(size_t bytes);
+void mem_count_free(size_t bytes);
+
+/* Read all counters */
+void mem_counts(mem_counts_t *m);
+
+/* Start following the peak of memory in use by this thread */
+typedef struct {
+    int64_t base, window;
+} mem_mark_t;
+mem_mark_t mem_peak_mark();
+
+/* Return how far memory in use rose above its level at mark.  Marks nest:
+ * the peak of an outer span includes those of inner ones.
+ */
+size_t mem_peak_rise(mem_mark_t mark);
+
 /* Time counted as fp number in seconds */
 void init_time(double *timep);
 
@@ -0,0 +1,139 @@
+#!/usr/bin/env python3
+
+# Time qtest on generated traces, reproducing the figures quoted for the
+# optimizations of the harness and the console.  Each benchmark reports the
+# best of several runs, as timings on a shared machine vary a lot.
+
+import getopt
+import os
+import re
+import subprocess
+import sys
+import tempfile
+import time
+
+
+def run(qtest, cmds):
+    """Run qtest on cmds, return its output and the wall-clock seconds"""
+    with tempfile.NamedTemporaryFile("w", suffix=".cmd", delete=False) as f:
+        f.write("\n".join(cmds) + "\n")
+        fname = f.name
+    try:
+        start = time.perf_counter()
+        out = subprocess.run([qtest, "-v", "1", "-f", fname],
+                             stdout=subprocess.PIPE,
+                             universal_newlines=True).stdout
+        elapsed = time.perf_counter() - start
+    finally:
+        os.unlink(fname)
+    return out, elapsed
+
+
+def delta_time(out):
+    """Seconds reported by the last 'time' command of a run"""
+    times = re.findall(r"Delta time = ([0-9.]+)", out)
+    if not times:
+        raise RuntimeError("no timing in qtest output:\n" + out)
+    return float(times[-1])
+
+
+def best_time(qtest, cmds, repeat):
+    """Shortest time reported by the last 'time' command over repeat runs"""
+    return min(delta_time(run(qtest, cmds)[0]) for _ in range(repeat))
+
+
+def bench_alloc(qtest, repeat):
+    """Harness overhead per allocation: each inserted element takes two"""
+    n = 1000000
+    modes = [("full checks, fill", []),
+             ("full checks, no fill", ["option fill 0"]),
+             ("lite", ["option lite 1"])]
+    for label, opts in modes:
+        cmds = opts + ["new", "time ih dolphin %d" % n, "free"]
+        best = best_time(qtest, cmds, repeat)
+        print("  %-22s %6.3f s  %5.1f ns per allocation" %
+              (label, best, best * 1e9 / (2 * n)))
+
+
+def bench_append(qtest, repeat):
+    """Growing one value through realloc, one or two bytes at a time"""
+    n = 100000
+    for value in ["x", "yz"]:
+        cmds = ["new", "ih a", "time append %s %d" % (value, n), "free"]
+        best = best_time(qtest, cmds, repeat)
+        print("  %-22s %6.3f s" % ("%d x '%s'" % (n, value), best))
+
+
+def bench_timer(qtest, repeat):
+    """Commands per second when each one sets up a time limit"""
+    n = 100000
+    for label, mode in [("alarm per operation", 0), ("timer mode", 1)]:
+        cmds = ["option timer %d" % mode, "new"] + ["ih a", "rh a"] * n
+        cmds.append("free")
+        best = min(run(qtest, cmds)[1] for _ in range(repeat))
+        print("  %-22s %6.3f s  %5.2fM commands/s" %
+              (label, best, 2 * n / best / 1e6))
+
+
+def bench_dispatch(qtest, repeat):
+    """Lines per second through command and option lookup"""
+    n = 500000
+    cmds = ["new"] + ["size", "option length 1024"] * n + ["free"]
+    best = min(run(qtest, cmds)[1] for _ in range(repeat))
+    print("  %-22s %6.3f s  %5.2fM commands/s" %
+          ("%dk lines" % (2 * n // 1000), best, 2 * n / best / 1e6))
+
+
+def bench_find(qtest, repeat):
+    """First lookup, which builds the index, in a queue of one repeated value"""
+    for n in [10000, 40000, 1000000]:
+        cmds = ["new", "ih x %d" % n, "time find x", "free"]
+        best = best_time(qtest, cmds, repeat)
+        print("  %-22s %6.3f s" % ("%dk x 'x'" % (n // 1000), best))
+
+
+BENCHMARKS = {
+    "alloc": bench_alloc,
+    "append": bench_append,
+    "timer": bench_timer,
+    "dispatch": bench_dispatch,
+    "find": bench_find,
+}
+
+
+def usage(name):
+    print("Usage: %s [-h] [-q QTEST] [-r REPEAT] [BENCHMARK...]" % name)
+    print("  -h         Print this message")
+    print("  -q QTEST   Program to time (default: ./qtest)")
+    print("  -r REPEAT  Runs of each measurement, best is kept (default: 3)")
+    print("Benchmarks: %s (default: all)" % " ".join(BENCHMARKS))
+    sys.exit(0)
+
+
+def main():
+    qtest = "./qtest"
+    repeat = 3
+    try:
+        opts, args = getopt.getopt(sys.argv[1:], "hq:r:")
+    except getopt.GetoptError as e:
+        print(e)
+        usage(sys.argv[0])
+    for opt, val in opts:
+        if opt == "-h":
+            usage(sys.argv[0])
+        elif opt == "-q":
+            qtest = val
+        elif opt == "-r":
+            repeat = int(val)
+
+    for name in args:
+        if name not in BENCHMARKS:
+            print("Unknown benchmark '%s'" % name)
+            usage(sys.argv[0])
+    for name in args or BENCHMARKS:
+        print(name)
+        BENCHMARKS[name](qtest, repeat)
+
+
+if __name__ == "__main__":
+    main()
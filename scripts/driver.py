@@ -60,6 +60,16 @@ class Tracer:
 
     maxScores = [0, 5, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 5]
 
+    # Traces of optional features, which pass or fail without points.  Each
+    # runs at the given verbosity and its output is checked by the named
+    # method, returning None or what went wrong.
+    featureList = [
+        ("trace-mem", 1, "checkMem"),
+        ("trace-perf", 1, "checkPerf"),
+        ("trace-compile", 3, "checkCompile"),
+        ("trace-resave", 1, "checkResave"),
+    ]
+
     RED = '\033[91m'
     GREEN = '\033[92m'
     WHITE = '\033[0m'
@@ -97,6 +107,87 @@ class Tracer:
             return False
         return retcode == 0
 
+    def checkMem(self, lines):
+        # Lines run between the last two 'mem' must not allocate
+        totals = [l for l in lines if " allocations, " in l]
+        if len(totals) < 2:
+            return "expected at least two memory totals"
+        if totals[-1] != totals[-2]:
+            return "totals moved from '%s' to '%s'" % (totals[-2], totals[-1])
+        return None
+
+    def perfTables(self, lines):
+        tables = []
+        for l in lines:
+            if l.startswith("per run"):
+                tables.append({})
+            elif tables and len(l.split()) > 2 and l.split()[1].isdigit():
+                tables[-1][l.split()[0]] = int(l.split()[1])
+        return tables
+
+    def checkPerf(self, lines):
+        # Each command run once is counted once, and reset forgets them
+        tables = self.perfTables(lines)
+        if len(tables) != 2:
+            return "expected 2 tables of counters, got %d" % len(tables)
+        ran = ["new", "it", "sort", "reverse", "time"]
+        for name in ran:
+            if tables[0].get(name) != 1:
+                return "'%s' counted %s times" % (name, tables[0].get(name))
+        for name in ran:
+            if name in tables[1]:
+                return "'%s' still counted after reset" % name
+        if not lines or not lines[-1].startswith("Counting is off"):
+            return "counting not off at the end"
+        return None
+
+    def checkCompile(self, lines):
+        # The script and its compiled form print the same
+        starts = [i for i, l in enumerate(lines) if l.startswith("cmd> source ")]
+        if len(starts) != 2:
+            return "expected 2 sourced scripts, got %d" % len(starts)
+        text = lines[starts[0] + 1:starts[1]]
+        compiled = lines[starts[1] + 1:starts[1] + 1 + len(text)]
+        if len(text) < 2:
+            return "sourced script printed nothing"
+        for t, c in zip(text, compiled + [""] * len(text)):
+            if t != c:
+                return "text printed '%s', compiled '%s'" % (t, c)
+        return None
+
+    def checkResave(self, lines):
+        # The loaded queue survives its file being saved over
+        expect = "l = [apple apple apple apple apple banana]"
+        shown = [l for l in lines if l.startswith("l = ")]
+        if shown != [expect, expect]:
+            return "expected '%s' twice, got %s" % (expect, shown)
+        return None
+
+    def runFeature(self, tname, vlevel, check):
+        fname = "%s/%s.cmd" % (self.traceDirectory, tname)
+        clist = self.command + ["-v", "%d" % vlevel, "-f", fname]
+        try:
+            p = subprocess.run(clist, stdout=subprocess.PIPE,
+                               universal_newlines=True)
+        except Exception as e:
+            return "call of '%s' failed: %s" % (" ".join(clist), e)
+        if self.verbLevel > 1:
+            print(p.stdout, end='')
+        if p.returncode != 0:
+            return "exit status %d" % p.returncode
+        return getattr(self, check)(p.stdout.splitlines())
+
+    def runFeatures(self):
+        failed = 0
+        for tname, vlevel, check in self.featureList:
+            err = self.runFeature(tname, vlevel, check)
+            if err:
+                self.printInColor("---\t%s\tFAILED: %s" % (tname, err), self.RED)
+                failed += 1
+            else:
+                self.printInColor("---\t%s\tpassed" % tname, self.GREEN)
+        return failed == 0
+
     def run(self, tid=0):
         scoreDict = {k: 0 for k in self.traceDict.keys()}
         print("---\tTrace\t\tPoints")
@@ -131,6 +222,10 @@ class Tracer:
             self.printInColor("---\tTOTAL\t\t%d/%d" % (score, maxscore), self.RED)
         else:
             self.printInColor("---\tTOTAL\t\t%d/%d" % (score, maxscore), self.GREEN)
+        # Optional features are checked on full runs, outside the grade
+        featuresOk = True
+        if tid == 0 and not self.autograde:
+            featuresOk = self.runFeatures()
         if self.autograde:
             # Generate JSON string
             jstring = '{"scores": {'
@@ -142,7 +237,7 @@ class Tracer:
                 jstring += '"%s" : %d' % (self.traceProbs[k], scoreDict[k])
             jstring += '}}'
             print(jstring)
-        if score < maxscore:
+        if score < maxscore or not featuresOk:
             sys.exit(1)
 
 def usage(name):
@@ -0,0 +1,120 @@
+#!/usr/bin/env python3
+
+# Convert an event log written by `qtest -e EFILE` to CSV or JSON lines.
+# The format is described in evlog.h.
+
+import argparse
+import csv
+import json
+import sys
+
+MAGIC = b"LAB0EVL"
+VERSION = 2
+EVLOG_NAME, EVLOG_CMD, EVLOG_EVENT = range(3)
+MSG_NAMES = ["WARNING", "ERROR", "FATAL ERROR"]
+FIELDS = ["type", "time_ns", "name", "qid", "args", "ok", "duration_ns",
+          "blocks", "allocs", "frees", "alloc_bytes", "free_bytes",
+          "message"]
+
+
+class Reader:
+    def __init__(self, data):
+        self.data = data
+        self.pos = 0
+
+    def byte(self):
+        if self.pos >= len(self.data):
+            raise EOFError
+        b = self.data[self.pos]
+        self.pos += 1
+        return b
+
+    def varint(self):
+        v = shift = 0
+        while True:
+            b = self.byte()
+            v |= (b & 0x7f) << shift
+            shift += 7
+            if not b & 0x80:
+                return v
+
+    def signed(self):
+        v = self.varint()
+        return (v >> 1) ^ -(v & 1)
+
+    def string(self):
+        n = self.varint()
+        if self.pos + n > len(self.data):
+            raise EOFError
+        s = self.data[self.pos:self.pos + n]
+        self.pos += n
+        return s.decode("utf-8", "replace")
+
+
+def records(data):
+    """Yield the commands and events of a log, in order of appearance"""
+    if data[:len(MAGIC)] != MAGIC:
+        raise ValueError("not an event log")
+    if data[len(MAGIC)] != VERSION:
+        raise ValueError("unsupported version %d" % data[len(MAGIC)])
+    r = Reader(data)
+    r.pos = len(MAGIC) + 1
+    now = r.varint()
+    names = {}
+    try:
+        while r.pos < len(data):
+            kind = r.byte()
+            if kind == EVLOG_NAME:
+                ident = r.varint()
+                names[ident] = r.string()
+                continue
+            now += r.signed()
+            if kind == EVLOG_CMD:
+                name = names.get(r.varint(), "?")
+                qid = r.varint() - 1
+                args = [r.string() for _ in range(r.varint())]
+                ok = bool(r.byte())
+                yield {"type": "cmd", "time_ns": now, "name": name,
+                       "qid": qid if qid >= 0 else None, "args": args,
+                       "ok": ok, "duration_ns": r.varint(),
+                       "blocks": r.signed(), "allocs": r.varint(),
+                       "frees": r.varint(), "alloc_bytes": r.varint(),
+                       "free_bytes": r.varint()}
+            elif kind == EVLOG_EVENT:
+                msg = r.varint()
+                yield {"type": "event", "time_ns": now,
+                       "name": MSG_NAMES[min(msg, len(MSG_NAMES) - 1)],
+                       "message": r.string()}
+            else:
+                raise ValueError("bad record type %d at offset %d" %
+                                 (kind, r.pos - 1))
+    except EOFError:
+        # A log cut short by a crash ends with a partial record
+        print("warning: log truncated at offset %d" % r.pos, file=sys.stderr)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("-f", "--format", choices=["csv", "json"],
+                        default="csv", help="output format (default: csv)")
+    parser.add_argument("file", help="event log written by qtest -e")
+    args = parser.parse_args()
+
+    with open(args.file, "rb") as f:
+        data = f.read()
+
+    out = sys.stdout
+    if args.format == "csv":
+        w = csv.DictWriter(out, fieldnames=FIELDS)
+        w.writeheader()
+        for rec in records(data):
+            if "args" in rec:
+                rec["args"] = " ".join(rec["args"])
+            w.writerow(rec)
+    else:
+        for rec in records(data):
+            out.write(json.dumps(rec) + "\n")
+
+
+if __name__ == "__main__":
+    main()
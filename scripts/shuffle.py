@@ -0,0 +1,92 @@
+#!/usr/bin/env python3
+
+# Check that the 'shuffle' command of qtest produces uniformly distributed
+# permutations, using Pearson's chi-squared test.
+
+import getopt
+import itertools
+import math
+import os
+import subprocess
+import sys
+import tempfile
+
+
+def chi2_critical(df, z=1.6449):
+    # Wilson-Hilferty approximation, z is the normal quantile (alpha = 0.05)
+    k = 2.0 / (9.0 * df)
+    return df * (1.0 - k + z * math.sqrt(k))**3
+
+
+def run(qtest, nelem, times):
+    elems = [str(i + 1) for i in range(nelem)]
+    cmds = ["new"] + ["it %s" % e for e in elems]
+    cmds += ["shuffle"] * times
+    cmds += ["free", "quit"]
+
+    with tempfile.NamedTemporaryFile("w", suffix=".cmd", delete=False) as f:
+        f.write("\n".join(cmds) + "\n")
+        fname = f.name
+    try:
+        out = subprocess.run([qtest, "-v", "3", "-f", fname],
+                             stdout=subprocess.PIPE,
+                             universal_newlines=True).stdout
+    finally:
+        os.unlink(fname)
+
+    counts = {p: 0 for p in itertools.permutations(elems)}
+    shuffled = False
+    for line in out.splitlines():
+        if line.startswith("cmd> "):
+            shuffled = line.split()[1:2] == ["shuffle"]
+        elif shuffled and line.startswith("l = ["):
+            counts[tuple(line[5:-1].split())] += 1
+            shuffled = False
+
+    total = sum(counts.values())
+    if total != times:
+        print("ERROR: Collected %d of %d permutations" % (total, times))
+        return False
+
+    expected = times / len(counts)
+    chi2 = 0.0
+    for p, c in sorted(counts.items()):
+        print("%s: %d" % (" ".join(p), c))
+        chi2 += (c - expected)**2 / expected
+
+    df = len(counts) - 1
+    critical = chi2_critical(df)
+    print("Expectation: %.1f" % expected)
+    print("Chi-squared sum: %.3f (critical value %.3f, df = %d)" %
+          (chi2, critical, df))
+    if chi2 > critical:
+        print("ERROR: Permutations are not uniformly distributed")
+        return False
+    print("Permutations are uniformly distributed")
+    return True
+
+
+def usage(name):
+    print("Usage: %s [-h] [-p PROG] [-n NELEM] [-t TIMES]" % name)
+    print("  -h        Print this message")
+    print("  -p PROG   Program to test (default: ./qtest)")
+    print("  -n NELEM  Number of elements in queue (default: 4)")
+    print("  -t TIMES  Number of shuffles (default: 100000)")
+    sys.exit(0)
+
+
+if __name__ == "__main__":
+    qtest = "./qtest"
+    nelem = 4
+    times = 100000
+    optlist, args = getopt.getopt(sys.argv[1:], 'hp:n:t:')
+    for (opt, val) in optlist:
+        if opt == '-h':
+            usage(sys.argv[0])
+        elif opt == '-p':
+            qtest = val
+        elif opt == '-n':
+            nelem = int(val)
+        elif opt == '-t':
+            times = int(val)
+    sys.exit(0 if run(qtest, nelem, times) else 1)
@@ -0,0 +1,292 @@
+/* String storage for queue element values */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "harness.h"
+#include "strpool.h"
+
+/* Values are queue data, so they are allocated through the test harness
+ * like any other element storage.
+ */
+
+int intern_mode = 0;
+
+/* Interned strings are kept in chained buckets, with the string stored
+ * inline after its bookkeeping.
+ */
+typedef struct __intern_entry {
+    struct __intern_entry *next;
+    size_t hash;
+    size_t refcnt;
+    char str[0];
+} intern_entry_t;
+
+#define MIN_BUCKETS 64
+
+struct __strpool_region {
+    struct __strpool_region *next;
+    char *base;
+    size_t len;
+    size_t refcnt;
+    strpool_unmap_t unmap;
+};
+
+/* Few regions are expected to be live at once, so a list will do */
+static strpool_region_t *regions = NULL;
+
+static intern_entry_t **buckets = NULL;
+static size_t bucket_count = 0;
+static size_t entry_count = 0;
+
+/* FNV-1a hash, also reporting the length of s */
+static size_t hash_string(const char *s, size_t *lenp)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    const char *p = s;
+    while (*p) {
+        h ^= (unsigned char) *p++;
+        h *= 0x100000001b3ULL;
+    }
+    *lenp = p - s;
+    return (size_t) h;
+}
+
+static intern_entry_t *entry_of(const char *s)
+{
+    return (intern_entry_t *) ((size_t) s - sizeof(intern_entry_t));
+}
+
+/* Double the bucket array once the load factor exceeds one.
+ * Failing to grow only makes chains longer, so it is not an error.
+ */
+static void grow_table()
+{
+    size_t new_count = bucket_count ? bucket_count * 2 : MIN_BUCKETS;
+    intern_entry_t **new_buckets = calloc(new_count, sizeof(*new_buckets));
+    if (!new_buckets)
+        return;
+
+    for (size_t i = 0; i < bucket_count; i++) {
+        intern_entry_t *e = buckets[i];
+        while (e) {
+            intern_entry_t *next = e->next;
+            size_t b = e->hash & (new_count - 1);
+            e->next = new_buckets[b];
+            new_buckets[b] = e;
+            e = next;
+        }
+    }
+    free(buckets);
+    buckets = new_buckets;
+    bucket_count = new_count;
+}
+
+static char *intern(const char *s)
+{
+    size_t len;
+    size_t hash = hash_string(s, &len);
+
+    if (buckets) {
+        intern_entry_t *e = buckets[hash & (bucket_count - 1)];
+        for (; e; e = e->next) {
+            if (e->hash == hash && !strcmp(e->str, s)) {
+                e->refcnt++;
+                return e->str;
+            }
+        }
+    }
+
+    if (entry_count >= bucket_count)
+        grow_table();
+    if (!buckets)
+        return NULL;
+
+    intern_entry_t *e = malloc(sizeof(intern_entry_t) + len + 1);
+    if (!e) {
+        if (!entry_count) {
+            free(buckets);
+            buckets = NULL;
+            bucket_count = 0;
+        }
+        return NULL;
+    }
+    memcpy(e->str, s, len + 1);
+    e->hash = hash;
+    e->refcnt = 1;
+
+    size_t b = hash & (bucket_count - 1);
+    e->next = buckets[b];
+    buckets[b] = e;
+    entry_count++;
+    return e->str;
+}
+
+/* Find the link pointing at the entry owning s, NULL if s is not interned.
+ * Only the address matters: an ordinary copy with the same content is not
+ * part of the table.
+ */
+static intern_entry_t **find_link(const char *s)
+{
+    if (!buckets)
+        return NULL;
+
+    size_t len;
+    size_t hash = hash_string(s, &len);
+    intern_entry_t **link = &buckets[hash & (bucket_count - 1)];
+    for (; *link; link = &(*link)->next) {
+        if ((*link)->str == s)
+            return link;
+    }
+    return NULL;
+}
+
+static strpool_region_t *region_of(const char *s)
+{
+    for (strpool_region_t *r = regions; r; r = r->next) {
+        if (s >= r->base && s < r->base + r->len)
+            return r;
+    }
+    return NULL;
+}
+
+strpool_region_t *strpool_region_new(char *base,
+                                     size_t len,
+                                     strpool_unmap_t unmap)
+{
+    strpool_region_t *r = malloc(sizeof(strpool_region_t));
+    if (!r)
+        return NULL;
+
+    r->base = base;
+    r->len = len;
+    r->refcnt = 1;
+    r->unmap = unmap;
+    r->next = regions;
+    regions = r;
+    return r;
+}
+
+char *strpool_region_get(strpool_region_t *r, char *s)
+{
+    r->refcnt++;
+    return s;
+}
+
+void strpool_region_put(strpool_region_t *r)
+{
+    if (--r->refcnt)
+        return;
+
+    strpool_region_t **link = &regions;
+    while (*link != r)
+        link = &(*link)->next;
+    *link = r->next;
+    r->unmap(r->base, r->len);
+    free(r);
+}
+
+char *strpool_dup(const char *s)
+{
+    return intern_mode ? intern(s) : strdup(s);
+}
+
+char *strpool_share(char **sp)
+{
+    char *s = *sp;
+    strpool_region_t *r = regions ? region_of(s) : NULL;
+    if (r)
+        return strpool_region_get(r, s);
+
+    if (find_link(s)) {
+        entry_of(s)->refcnt++;
+        return s;
+    }
+
+    char *shared = intern(s);
+    if (!shared)
+        return NULL;
+    free(s);
+    *sp = shared;
+    entry_of(shared)->refcnt++;
+    return shared;
+}
+
+char *strpool_append(char **sp, const char *suffix)
+{
+    char *s = *sp;
+    size_t len = strlen(s), slen = strlen(suffix);
+
+    /* A private copy grows where it is, unless equal values are shared */
+    if (!intern_mode && !(regions && region_of(s)) && !find_link(s)) {
+        char *grown = realloc(s, len + slen + 1);
+        if (!grown)
+            return NULL;
+        memcpy(grown + len, suffix, slen + 1);
+        *sp = grown;
+        return grown;
+    }
+
+    char *joined = malloc(len + slen + 1);
+    if (!joined)
+        return NULL;
+    memcpy(joined, s, len);
+    memcpy(joined + len, suffix, slen + 1);
+    char *value = joined;
+    if (intern_mode) {
+        value = intern(joined);
+        free(joined);
+        if (!value)
+            return NULL;
+    }
+    strpool_release(s);
+    *sp = value;
+    return value;
+}
+
+void strpool_release(char *s)
+{
+    if (!s)
+        return;
+
+    strpool_region_t *r = regions ? region_of(s) : NULL;
+    if (r) {
+        strpool_region_put(r);
+        return;
+    }
+
+    intern_entry_t **link = find_link(s);
+    if (!link) {
+        free(s);
+        return;
+    }
+
+    intern_entry_t *e = entry_of(s);
+    if (--e->refcnt)
+        return;
+
+    *link = e->next;
+    free(e);
+    /* Give the table back once empty, so no blocks outlive the queues */
+    if (!--entry_count) {
+        free(buckets);
+        buckets = NULL;
+        bucket_count = 0;
+    }
+}
+
+bool strpool_is_interned(const char *s)
+{
+    return s && find_link(s);
+}
+
+size_t strpool_count()
+{
+    return entry_count;
+}
+
+size_t strpool_hash(const char *s)
+{
+    size_t len;
+    return hash_string(s, &len);
+}
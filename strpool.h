@@ -0,0 +1,68 @@
+#ifndef LAB0_STRPOOL_H
+#define LAB0_STRPOOL_H
+
+/* Storage for the strings held by queue elements.
+ *
+ * By default every value is an independent copy, exactly as strdup would
+ * return.  With interning enabled, equal strings share one reference-counted
+ * allocation kept in a global hash table, so repetitive workloads store a
+ * single copy per distinct value.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Values may also live in place inside a region of memory owned by someone
+ * else, such as a mapped file.  A region is reference-counted by the values
+ * pointing into it and handed back through its unmap function once the last
+ * of them has been released.
+ */
+typedef struct __strpool_region strpool_region_t;
+typedef void (*strpool_unmap_t)(char *base, size_t len);
+
+/* Share storage of equal values when non-zero */
+extern int intern_mode;
+
+/* Copy string s for storage in a queue element.
+ * Return NULL for allocation failed.
+ */
+char *strpool_dup(const char *s);
+
+/* Take another reference to the value stored at *sp.
+ * A private copy is moved into the intern table first and *sp updated, so
+ * the value can be shared copy-on-write.  Return NULL for allocation failed.
+ */
+char *strpool_share(char **sp);
+
+/* Append suffix to the value stored at *sp, updating *sp.
+ * A private copy is grown in place when possible; a shared value is copied
+ * first.  Return NULL for allocation failed, leaving the value unchanged.
+ */
+char *strpool_append(char **sp, const char *suffix);
+
+/* Release a value obtained from strpool_dup or strpool_share */
+void strpool_release(char *s);
+
+/* Track region [base, base + len) holding NUL-terminated values.
+ * The caller holds the initial reference.  Return NULL for allocation failed.
+ */
+strpool_region_t *strpool_region_new(char *base,
+                                     size_t len,
+                                     strpool_unmap_t unmap);
+
+/* Take a reference to region r for value s inside it, and return s */
+char *strpool_region_get(strpool_region_t *r, char *s);
+
+/* Drop a reference to region r, unmapping it when it was the last one */
+void strpool_region_put(strpool_region_t *r);
+
+/* Return whether s is shared through the intern table */
+bool strpool_is_interned(const char *s);
+
+/* Number of distinct values currently in the intern table */
+size_t strpool_count();
+
+/* Hash of string s, as used by the intern table */
+size_t strpool_hash(const char *s);
+
+#endif /* LAB0_STRPOOL_H */
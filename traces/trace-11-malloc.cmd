@@ -1,4 +1,5 @@
 # Test of malloc failure on insert_head
+option malloc_seed 1
 option fail 30
 option malloc 0
 new
@@ -1,4 +1,5 @@
 # Test of malloc failure on insert_tail
+option malloc_seed 1
 option fail 50
 option malloc 0
 new
@@ -1,4 +1,5 @@
 # Test of malloc failure on new
+option malloc_seed 1
 option fail 10
 option malloc 50
 new
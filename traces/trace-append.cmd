@@ -0,0 +1,23 @@
+# Test of appending to the value of the last element
+new
+ih dolphin
+it bear
+append cat
+append s 10
+find bearcatssssssssss
+find bear
+rt bearcatssssssssss
+option intern 1
+it gerbil
+clone
+append s 3
+find gerbilsss
+rt gerbilsss
+option intern 0
+option malloc_seed 1
+option fail 100
+option malloc 50
+append x 20
+option malloc 0
+free
+free
@@ -0,0 +1,34 @@
+# Test of cloning a queue and changing both copies independently
+new
+ih dolphin
+ih bear
+it gerbil 2
+clone
+sort
+rh bear
+rt gerbil
+prev
+size
+rh bear
+rh dolphin
+reverse
+rh gerbil
+next
+free
+free
+option intern 1
+new
+ih meerkat 3
+clone
+dedup
+free
+rh meerkat
+free
+option malloc 0
+new
+ih RAND 100000
+clone
+sort
+free
+free
+quit
@@ -0,0 +1,38 @@
+# Test of front-coded storage of sorted queues
+new
+it candle
+it apple
+it cane
+it application
+it bandana
+it candy
+it apply
+it band
+it canoe
+it applesauce
+sort
+compact
+size
+rh apple
+rt canoe
+rh applesauce
+# Removals do not allocate, so they cannot fail
+option fail 100
+option malloc 50
+rh application
+rt cane
+option malloc 0
+size
+ih aardvark
+sort
+rh aardvark
+rh apply
+compact
+new
+it RAND 1000
+sort
+compact
+size
+merge
+size
+free
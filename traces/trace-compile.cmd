@@ -0,0 +1,7 @@
+# Test of compiling a script and running the result, which must print the
+# same as running the script itself
+compile traces/trace-01-ops.cmd /tmp/qtest-trace-compile.bin
+source traces/trace-01-ops.cmd
+free
+source /tmp/qtest-trace-compile.bin
+free
@@ -0,0 +1,52 @@
+# Test of membership lookups kept up to date by queue operations
+new
+find dolphin
+ih dolphin
+ih bear 2
+it gerbil
+find bear
+find cat
+it cat
+find cat
+rh bear
+find bear
+rh bear
+find bear
+rt cat
+find cat
+dm
+find dolphin
+ih gerbil 3
+ih lion
+dedup
+find gerbil
+find lion
+it zebra
+it aardvark
+descend
+find aardvark
+find zebra
+new
+it RAND 2000
+it ant
+find ant
+merge
+find ant
+find zebra
+sort
+compact
+find zebra
+free
+# Repeated values share one entry, outliving the element first indexed
+new
+ih owl 3
+find owl
+rh owl
+find owl
+append s
+find owl
+find owls
+rh owl
+find owl
+find owls
+free
@@ -0,0 +1,35 @@
+# Test of queue operations with guard pages and a quarantine of freed blocks
+option guard 1
+option quarantine 100
+new
+ih dolphin 10
+it RAND 200
+sort
+dedup
+rh
+rt
+reverse
+swap
+option guard 16
+new
+it RAND 1000
+merge
+free
+option guard 0
+option quarantine 0
+new
+ih bear 5
+free
+# Blocks freed while older ones are still queued are filled without fill mode
+option fill 0
+option quarantine 4
+new
+ih seal 10
+rh seal
+rh seal
+option quarantine 0
+rh seal
+rh seal
+rh seal
+free
+option fill 1
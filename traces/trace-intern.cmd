@@ -0,0 +1,29 @@
+# Test of string interning: equal values share storage
+option intern 1
+new
+ih dolphin 3
+it gerbil 2
+ih gerbil
+it dolphin
+it meerkat
+size
+sort
+dedup
+rh meerkat
+free
+new
+ih bear 1000
+it bear 1000
+ih lion
+dm
+reverse
+sort
+rt lion
+rh bear
+option intern 0
+it bear
+it lion
+sort
+dedup
+free
+quit
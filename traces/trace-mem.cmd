@@ -0,0 +1,17 @@
+# Test of per-command memory accounting
+mem
+new
+ih dolphin 10
+rh dolphin
+it bear
+mem
+mem reset
+free
+mem
+# Parsing and dispatch allocate nothing: scripts/driver.py checks that the
+# totals of the last two mem commands are equal
+mem
+size
+option verbose 1
+size
+mem
@@ -0,0 +1,16 @@
+# Test of the allocation profiler
+memprof
+option memprof 1
+new
+ih dolphin 10
+it RAND 100
+find dolphin
+rh dolphin
+memprof
+memprof reset
+free
+option memprof 0
+new
+ih bear
+memprof
+free
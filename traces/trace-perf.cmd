@@ -0,0 +1,13 @@
+# Test of hardware counters around commands, whether or not the machine has them
+perf
+option perf 1
+new
+it RAND 1000
+sort
+time reverse
+perf
+perf reset
+perf
+option perf 0
+perf
+free
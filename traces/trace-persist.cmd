@@ -0,0 +1,27 @@
+# Test of saving a queue to file and loading it back
+new
+ih dolphin
+ih bear
+it gerbil 2
+it aardvark
+save /tmp/qtest-trace-persist.q
+sort
+save /tmp/qtest-trace-persist-sorted.q
+free
+load /tmp/qtest-trace-persist.q
+size
+rh bear
+rt aardvark
+sort
+dedup
+load /tmp/qtest-trace-persist-sorted.q
+clone
+option intern 1
+it bear
+reverse
+rh bear
+rh gerbil
+free
+free
+free
+quit
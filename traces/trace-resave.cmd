@@ -0,0 +1,14 @@
+# Test of saving a loaded queue over the file it was loaded from, whose
+# strings must stay readable
+new
+ih apple 5
+save /tmp/qtest-trace-resave.q
+free
+load /tmp/qtest-trace-resave.q
+it banana
+save /tmp/qtest-trace-resave.q
+show
+load /tmp/qtest-trace-resave.q
+show
+free
+free
@@ -0,0 +1,16 @@
+# Test performance of reverseK with group sizes from 2 up to the queue length
+option fail 0
+option malloc 0
+new
+ih dolphin 500000
+it gerbil 500000
+reverseK 2
+reverseK 3
+reverseK 7
+reverseK 10
+reverseK 100
+reverseK 1000
+reverseK 10000
+reverseK 100000
+reverseK 999999
+free
@@ -0,0 +1,13 @@
+# Test of per-command latency statistics
+stats
+new
+ih dolphin 10
+rh dolphin
+rh dolphin
+it bear
+size 5
+stats
+stats reset
+sort
+stats
+free
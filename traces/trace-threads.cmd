@@ -0,0 +1,11 @@
+# Test of queues built and freed concurrently under leak detection
+threads 1 100
+threads 4 10000
+new
+ih dolphin
+threads 16 1000
+option lite 1
+threads 4 1000
+option lite 0
+threads 4 1000
+free
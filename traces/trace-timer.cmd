@@ -0,0 +1,20 @@
+# Test of queue operations timed by one interval timer for the script
+option timer 1
+new
+ih dolphin
+ih bear
+it gerbil
+rh bear
+sort
+reverse
+option timeout 3
+it RAND 1000
+sort
+dedup
+option timer 0
+rt
+free
+option timer 1
+new
+ih cat 10
+free